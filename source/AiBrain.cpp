@@ -0,0 +1,61 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "AiBrain.h"
+
+const uint MAX_MOVE_TICKS = 600; // pick new target when this one can't be reached (blocked by others)
+const uint JUMP_CHANCE = 400; // 1 in N ticks while moving
+
+AiBrain::AiBrain(uint seed, float area) : area(area), state(seed), wait(0)
+{
+	PickTarget();
+}
+
+uint AiBrain::Rand()
+{
+	// lcg, same sequence on every platform
+	state = state * 1664525u + 1013904223u;
+	return state >> 8;
+}
+
+float AiBrain::Random(float a, float b)
+{
+	return a + (b - a) * float(Rand() & 0xFFFF) / 65535.f;
+}
+
+void AiBrain::PickTarget()
+{
+	target = Vec3(Random(-area, area), 0, Random(-area, area));
+	timer = MAX_MOVE_TICKS;
+	walk = Rand() % 3 == 0;
+}
+
+PlayerInput AiBrain::Think(const Player& player)
+{
+	PlayerInput input;
+	input.rot = player.rot;
+	input.dir = 0;
+	input.walk = false;
+	input.jump = false;
+
+	if(wait > 0)
+	{
+		--wait;
+		return input;
+	}
+
+	const float dx = target.x - player.pos.x, dz = target.z - player.pos.z;
+	if(dx * dx + dz * dz < 0.25f || --timer == 0)
+	{
+		PickTarget();
+		if(Rand() % 4 == 0)
+			wait = 30 + Rand() % 90;
+		return input;
+	}
+
+	// forward movement direction is (cos(3/2 PI - rot), sin(3/2 PI - rot))
+	input.rot = Clip(PI * 3 / 2 - atan2(dz, dx));
+	input.dir = 10;
+	input.walk = walk;
+	input.jump = Rand() % JUMP_CHANCE == 0;
+	return input;
+}
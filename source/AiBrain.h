@@ -0,0 +1,22 @@
+#pragma once
+
+#include "Player.h"
+
+// Simple wandering AI, walks or runs to random points inside square area, sometimes waits or jumps.
+// Produces same input as keyboard so agents use Player movement code. Deterministic for given seed.
+class AiBrain
+{
+public:
+	AiBrain(uint seed, float area);
+	PlayerInput Think(const Player& player);
+
+private:
+	uint Rand();
+	float Random(float a, float b);
+	void PickTarget();
+
+	Vec3 target;
+	float area; // half size of area around (0,0)
+	uint state, timer, wait;
+	bool walk;
+};
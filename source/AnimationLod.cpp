@@ -0,0 +1,90 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "AnimationLod.h"
+#include "Trace.h"
+#include <Camera.h>
+#include <SceneNode.h>
+#include <MeshInstance.h>
+
+// update every N frames for each level
+const uint lod_interval[AnimationLod::LOD_MAX] = { 1, 2, 4, 8 };
+
+AnimationLod::AnimationLod() : near_dist(10.f), far_dist(25.f), hysteresis(1.f), frame(0), sampled(0), level_count()
+{
+}
+
+// create mesh instance for node and register it
+MeshInstance* AnimationLod::Add(SceneNode* node, Mesh* mesh)
+{
+	node->SetMesh(new MeshInstance(mesh));
+	Entry e;
+	e.node = node;
+	e.dt = 0.f;
+	e.level = LOD_NEAR;
+	e.phase = (uint)entries.size();
+	entries.push_back(e);
+	return node->mesh_inst;
+}
+
+void AnimationLod::Remove(SceneNode* node)
+{
+	for(uint i = 0; i < entries.size(); ++i)
+	{
+		if(entries[i].node == node)
+		{
+			entries[i] = entries.back();
+			entries.pop_back();
+			return;
+		}
+	}
+}
+
+void AnimationLod::Update(float dt, const Camera& camera)
+{
+	TRACE_ZONE("AnimationLod::Update");
+	const FrustumPlanes frustum(Matrix::CreateLookAt(camera.from, camera.to, camera.up)
+		* Matrix::CreatePerspectiveFieldOfView(camera.fov, camera.aspect, camera.znear, camera.zfar));
+
+	++frame;
+	sampled = 0;
+	for(uint i = 0; i < LOD_MAX; ++i)
+		level_count[i] = 0;
+
+	for(Entry& e : entries)
+	{
+		SceneNode* node = e.node;
+		const Mesh::Header& head = node->mesh_inst->mesh->head;
+		const Vec3 center = node->pos + (head.bbox.v1 + head.bbox.v2) / 2;
+		Level level;
+		if(!frustum.SphereToFrustum(center, head.radius))
+			level = LOD_HIDDEN;
+		else
+			level = GetLevel(e, Vec3::Distance(camera.from, center));
+
+		// moving to finer level must not wait for next interval, pose could be many frames old
+		const bool refresh = level < e.level;
+		e.level = level;
+		e.dt += dt;
+		++level_count[level];
+		if(refresh || (frame + e.phase) % lod_interval[level] == 0)
+		{
+			node->mesh_inst->Update(e.dt);
+			e.dt = 0.f;
+			++sampled;
+		}
+	}
+}
+
+// distance level with hysteresis, boundary is moved away from current level
+AnimationLod::Level AnimationLod::GetLevel(const Entry& e, float dist) const
+{
+	const float limits[] = { near_dist, far_dist };
+	uint level = LOD_NEAR;
+	for(uint i = 0; i < countof(limits); ++i)
+	{
+		const float limit = (uint)e.level <= i ? limits[i] + hysteresis : limits[i] - hysteresis;
+		if(dist > limit)
+			level = i + 1;
+	}
+	return (Level)level;
+}
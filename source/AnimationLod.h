@@ -0,0 +1,45 @@
+#pragma once
+
+// Updates animated mesh instances of characters at rate depending on distance to camera instead of every frame.
+// Skipped frames time is accumulated and passed to next update, so animations don't slow down, only pose is sampled
+// less often (bones are evaluated by renderer only after MeshInstance::Update). Off-screen nodes only advance time
+// at lowest rate, when node becomes visible or moves closer it is updated at once so pose is never stale.
+// Scene isn't updated, so this class owns every mesh instance: they are created only by Add, one made elsewhere would
+// never animate.
+class AnimationLod
+{
+public:
+	enum Level
+	{
+		LOD_NEAR,
+		LOD_MID,
+		LOD_FAR,
+		LOD_HIDDEN,
+		LOD_MAX
+	};
+
+	AnimationLod();
+	MeshInstance* Add(SceneNode* node, Mesh* mesh);
+	void Remove(SceneNode* node);
+	void Update(float dt, const Camera& camera);
+	uint GetCount() const { return (uint)entries.size(); }
+	uint GetLevelCount(Level level) const { return level_count[level]; }
+	uint GetSampledCount() const { return sampled; } // mesh instances updated in last Update
+
+	float near_dist, far_dist; // distance where mid & far level starts
+	float hysteresis; // distance margin required to change level, prevents switching every frame at boundary
+
+private:
+	struct Entry
+	{
+		SceneNode* node;
+		float dt; // not applied time
+		Level level;
+		uint phase; // spreads updates of same level across frames
+	};
+
+	Level GetLevel(const Entry& e, float dist) const;
+
+	vector<Entry> entries;
+	uint frame, sampled, level_count[LOD_MAX];
+};
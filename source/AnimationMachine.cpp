@@ -0,0 +1,204 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "AnimationMachine.h"
+#include <MeshInstance.h>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+	// same as former hardcoded human animations
+	cstring default_machine =
+		"state stand stoi\n"
+		"state walk idzie\n"
+		"state walk_back idzie back\n"
+		"state run biegnie\n"
+		"state rotate_left w_lewo\n"
+		"state rotate_right w_prawo\n"
+		"transition * run speed >= 4\n"
+		"transition * walk speed >= 0.5 move_angle <= 1.5708\n"
+		"transition * walk_back speed >= 0.5\n"
+		"transition * rotate_left rotate < 0\n"
+		"transition * rotate_right rotate > 0\n"
+		"transition * stand\n";
+
+	cstring param_names[AnimationMachine::P_MAX] = { "speed", "move_angle", "rotate" };
+	cstring op_names[] = { "<", "<=", ">", ">=", "==" };
+}
+
+bool AnimationMachine::Load(cstring path, Mesh* mesh)
+{
+	std::ifstream file(path);
+	if(!file)
+		return false;
+	return Parse(file, mesh);
+}
+
+void AnimationMachine::SetDefault(Mesh* mesh)
+{
+	std::istringstream input(default_machine);
+	Parse(input, mesh);
+}
+
+bool AnimationMachine::Parse(std::istream& input, Mesh* mesh)
+{
+	states.clear();
+	transitions.clear();
+	conditions.clear();
+
+	string line, token;
+	uint line_index = 0;
+	vector<std::pair<string, string>> pending; // transition state names resolved after all states are known
+	while(std::getline(input, line))
+	{
+		++line_index;
+		std::istringstream s(line);
+		if(!(s >> token) || token[0] == '#')
+			continue;
+		if(token == "state")
+		{
+			State state;
+			string clip;
+			if(!(s >> state.name >> clip))
+			{
+				Error(Format("AnimationMachine: Invalid state at line %u.", line_index));
+				return false;
+			}
+			state.flags = 0;
+			state.blend = -1.f;
+			while(s >> token)
+			{
+				if(token == "back")
+					state.flags |= PLAY_BACK;
+				else if(token == "blend" && (s >> state.blend))
+					continue;
+				else
+				{
+					Error(Format("AnimationMachine: Invalid state option '%s' at line %u.", token.c_str(), line_index));
+					return false;
+				}
+			}
+			state.clip = nullptr;
+			if(mesh)
+			{
+				state.clip = mesh->GetAnimation(clip.c_str());
+				if(!state.clip)
+				{
+					Error(Format("AnimationMachine: Missing clip '%s' at line %u.", clip.c_str(), line_index));
+					return false;
+				}
+			}
+			states.push_back(state);
+		}
+		else if(token == "transition")
+		{
+			std::pair<string, string> names;
+			if(!(s >> names.first >> names.second))
+			{
+				Error(Format("AnimationMachine: Invalid transition at line %u.", line_index));
+				return false;
+			}
+			Transition transition;
+			transition.first_condition = (uint)conditions.size();
+			string param, op;
+			Condition c;
+			while(s >> param >> op >> c.value)
+			{
+				int p = 0, o = 0;
+				while(p < P_MAX && param != param_names[p])
+					++p;
+				while(o < (int)countof(op_names) && op != op_names[o])
+					++o;
+				if(p == P_MAX || o == (int)countof(op_names))
+				{
+					Error(Format("AnimationMachine: Invalid condition '%s %s' at line %u.", param.c_str(), op.c_str(), line_index));
+					return false;
+				}
+				c.param = (Param)p;
+				c.op = (Op)o;
+				conditions.push_back(c);
+			}
+			if(!s.eof())
+			{
+				Error(Format("AnimationMachine: Invalid condition at line %u.", line_index));
+				return false;
+			}
+			transition.conditions = (uint)conditions.size() - transition.first_condition;
+			transitions.push_back(transition);
+			pending.push_back(names);
+		}
+		else
+		{
+			Error(Format("AnimationMachine: Unknown entry '%s' at line %u.", token.c_str(), line_index));
+			return false;
+		}
+	}
+
+	for(uint i = 0; i < transitions.size(); ++i)
+	{
+		Transition& transition = transitions[i];
+		transition.from = pending[i].first == "*" ? -1 : GetState(pending[i].first.c_str());
+		transition.to = GetState(pending[i].second.c_str());
+		if((transition.from == -1 && pending[i].first != "*") || transition.to == -1)
+		{
+			Error(Format("AnimationMachine: Unknown state in transition '%s' -> '%s'.", pending[i].first.c_str(), pending[i].second.c_str()));
+			return false;
+		}
+	}
+	return !states.empty();
+}
+
+int AnimationMachine::GetState(cstring name) const
+{
+	for(uint i = 0; i < states.size(); ++i)
+	{
+		if(states[i].name == name)
+			return (int)i;
+	}
+	return -1;
+}
+
+// returns new state (or same when no transition matched)
+int AnimationMachine::Evaluate(int state, const float* params) const
+{
+	for(const Transition& transition : transitions)
+	{
+		if(transition.from != -1 && transition.from != state)
+			continue;
+		bool ok = true;
+		for(uint i = transition.first_condition, end = transition.first_condition + transition.conditions; i < end && ok; ++i)
+			ok = Test(conditions[i], params);
+		if(ok)
+			return transition.to;
+	}
+	return state;
+}
+
+bool AnimationMachine::Test(const Condition& c, const float* params) const
+{
+	const float value = params[c.param];
+	switch(c.op)
+	{
+	case OP_LESS:
+		return value < c.value;
+	case OP_LESS_EQUAL:
+		return value <= c.value;
+	case OP_GREATER:
+		return value > c.value;
+	case OP_GREATER_EQUAL:
+		return value >= c.value;
+	case OP_EQUAL:
+	default:
+		return value == c.value;
+	}
+}
+
+void AnimationMachine::Play(MeshInstance* mesh_inst, int state) const
+{
+	const State& s = states[state];
+	if(!s.clip)
+		return;
+	if(s.blend > 0.f)
+		mesh_inst->groups[0].blend_max = s.blend;
+	mesh_inst->Play(s.clip, s.blend == 0.f ? s.flags | PLAY_NO_BLEND : s.flags, 0);
+}
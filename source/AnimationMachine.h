@@ -0,0 +1,69 @@
+#pragma once
+
+#include <iosfwd>
+
+const cstring HUMAN_ANIM_PATH = "data/human.anim";
+
+// Animation state machine loaded from text file, shared by all characters using same mesh.
+// Clip names are resolved to animation handles once at load, Evaluate & Play don't allocate or compare strings.
+// Loaded without mesh (headless) states have no clips, Evaluate works the same and Play does nothing.
+// File format (# starts comment):
+//   state <name> <clip> [back] [blend <seconds>] (blend 0 disables blending, without it mesh instance blend time is kept)
+//   transition <from state|*> <to state> [<param> <op> <value>]...
+// params: speed, move_angle (angle between facing & movement), rotate (-1 left, 0, 1 right); op: < <= > >= ==
+// Transitions are checked in file order, first one from current state (or *) with all conditions met wins.
+class AnimationMachine
+{
+public:
+	enum Param
+	{
+		P_SPEED,
+		P_MOVE_ANGLE,
+		P_ROTATE,
+		P_MAX
+	};
+
+	bool Load(cstring path, Mesh* mesh);
+	bool Parse(std::istream& input, Mesh* mesh);
+	void SetDefault(Mesh* mesh);
+	int GetState(cstring name) const;
+	int Evaluate(int state, const float* params) const;
+	void Play(MeshInstance* mesh_inst, int state) const;
+
+private:
+	enum Op
+	{
+		OP_LESS,
+		OP_LESS_EQUAL,
+		OP_GREATER,
+		OP_GREATER_EQUAL,
+		OP_EQUAL
+	};
+
+	struct State
+	{
+		string name;
+		Mesh::Animation* clip; // nullptr when no mesh
+		int flags;
+		float blend; // -1 when not set
+	};
+
+	struct Condition
+	{
+		Param param;
+		Op op;
+		float value;
+	};
+
+	struct Transition
+	{
+		int from, to; // from -1 is any state
+		uint first_condition, conditions;
+	};
+
+	bool Test(const Condition& c, const float* params) const;
+
+	vector<State> states;
+	vector<Transition> transitions;
+	vector<Condition> conditions;
+};
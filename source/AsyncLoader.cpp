@@ -0,0 +1,201 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "AsyncLoader.h"
+#include "Trace.h"
+#include <chrono>
+#include <fstream>
+
+AsyncLoader::AsyncLoader(uint io_threads) : next_handle(0), pending(0), quit(false)
+{
+	if(io_threads == 0)
+		io_threads = 1;
+	for(uint i = 0; i < io_threads; ++i)
+		workers.push_back(std::thread(&AsyncLoader::WorkerLoop, this));
+}
+
+// not finished requests are cancelled
+AsyncLoader::~AsyncLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	cv_work.notify_all();
+	for(std::thread& worker : workers)
+		worker.join();
+	for(std::deque<Request*>& requests : queue)
+	{
+		for(Request* request : requests)
+			delete request;
+	}
+	DeleteElements(done);
+}
+
+AsyncLoader::Handle AsyncLoader::Load(Resource* res, Priority priority, Callback callback)
+{
+	Request* request = new Request;
+	request->res = res;
+	request->priority = priority;
+	request->callback = callback;
+	request->cancelled = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		request->handle = ++next_handle;
+		queue[priority].push_back(request);
+	}
+	++pending;
+	cv_work.notify_one();
+	return request->handle;
+}
+
+// moves request to other queue if it is still waiting for read, finished requests are also delivered by priority
+void AsyncLoader::SetPriority(Handle handle, Priority priority)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for(std::deque<Request*>& requests : queue)
+	{
+		for(auto it = requests.begin(), end = requests.end(); it != end; ++it)
+		{
+			if((*it)->handle == handle)
+			{
+				Request* request = *it;
+				requests.erase(it);
+				request->priority = priority;
+				queue[priority].push_back(request);
+				return;
+			}
+		}
+	}
+	for(Request* request : reading)
+	{
+		if(request->handle == handle)
+		{
+			request->priority = priority;
+			return;
+		}
+	}
+	for(Request* request : done)
+	{
+		if(request->handle == handle)
+		{
+			request->priority = priority;
+			return;
+		}
+	}
+}
+
+void AsyncLoader::Cancel(Handle handle)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for(std::deque<Request*>& requests : queue)
+	{
+		for(auto it = requests.begin(), end = requests.end(); it != end; ++it)
+		{
+			if((*it)->handle == handle)
+			{
+				delete *it;
+				requests.erase(it);
+				--pending;
+				return;
+			}
+		}
+	}
+	for(Request* request : reading)
+	{
+		// worker deletes it after read
+		if(request->handle == handle && !request->cancelled)
+		{
+			request->cancelled = true;
+			--pending;
+			return;
+		}
+	}
+	for(auto it = done.begin(), end = done.end(); it != end; ++it)
+	{
+		if((*it)->handle == handle)
+		{
+			delete *it;
+			done.erase(it);
+			--pending;
+			return;
+		}
+	}
+}
+
+// finish loading of read resources until time budget (in seconds) is used, at least one is finished if available
+void AsyncLoader::Update(float time_budget)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const Clock::time_point start = Clock::now();
+	while(Request* request = PopDone())
+	{
+		TRACE_ZONE_DETAIL("AsyncLoader::Load", request->res->filename.c_str());
+		app::res_mgr->Load(request->res);
+		--pending;
+		request->callback(request->res);
+		delete request;
+		if(std::chrono::duration<float>(Clock::now() - start).count() >= time_budget)
+			break;
+	}
+}
+
+AsyncLoader::Request* AsyncLoader::PopDone()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if(done.empty())
+		return nullptr;
+	uint best = 0;
+	for(uint i = 1; i < (uint)done.size(); ++i)
+	{
+		if(done[i]->priority > done[best]->priority)
+			best = i;
+	}
+	Request* request = done[best];
+	done.erase(done.begin() + best);
+	return request;
+}
+
+void AsyncLoader::WorkerLoop()
+{
+	vector<char> buffer(64 * 1024);
+	while(true)
+	{
+		Request* request = nullptr;
+		string path;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv_work.wait(lock, [this] { return quit || !queue[PRIORITY_HIGH].empty() || !queue[PRIORITY_NORMAL].empty() || !queue[PRIORITY_LOW].empty(); });
+			if(quit)
+				return;
+			for(int i = PRIORITY_MAX - 1; i >= 0; --i)
+			{
+				if(!queue[i].empty())
+				{
+					request = queue[i].front();
+					queue[i].pop_front();
+					break;
+				}
+			}
+			path = request->res->path;
+			reading.push_back(request);
+		}
+
+		// prefetch only, data is discarded; resources inside pak files can't be read directly, resource manager loads them in Update
+		{
+			TRACE_ZONE_DETAIL("AsyncLoader::Prefetch", request->res->filename.c_str());
+			std::ifstream file(path, std::ios::binary);
+			while(file.read(buffer.data(), buffer.size()))
+				;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			reading.erase(std::find(reading.begin(), reading.end(), request));
+			if(request->cancelled)
+				delete request;
+			else
+				done.push_back(request);
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <ResourceManager.h>
+
+// Loads resources without blocking main thread. I/O threads only prefetch requested files into os cache (high priority
+// first, same priority in request order) and discard read data, main thread then loads them again through resource
+// manager in Update within time budget, because decoding creates render buffers and resource manager isn't thread safe
+// and can't load from memory. Callbacks are called only on main thread and never after Cancel.
+class AsyncLoader
+{
+public:
+	enum Priority
+	{
+		PRIORITY_LOW,
+		PRIORITY_NORMAL,
+		PRIORITY_HIGH,
+		PRIORITY_MAX
+	};
+
+	typedef uint Handle;
+	typedef std::function<void(Resource*)> Callback;
+
+	explicit AsyncLoader(uint io_threads);
+	~AsyncLoader();
+	Handle Load(Resource* res, Priority priority, Callback callback);
+	template<typename T>
+	Handle Load(const string& filename, Priority priority, std::function<void(T*)> callback)
+	{
+		return Load(app::res_mgr->Get<T>(filename), priority, [callback](Resource* res) { callback(static_cast<T*>(res)); });
+	}
+	void SetPriority(Handle handle, Priority priority);
+	void Cancel(Handle handle);
+	void Update(float time_budget);
+	uint GetPendingCount() const { return pending; }
+
+private:
+	struct Request
+	{
+		Handle handle;
+		Resource* res;
+		Priority priority;
+		Callback callback;
+		bool cancelled;
+	};
+
+	void WorkerLoop();
+	Request* PopDone();
+
+	vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable cv_work;
+	std::deque<Request*> queue[PRIORITY_MAX];
+	vector<Request*> reading, done;
+	Handle next_handle;
+	uint pending; // requests with callback not called yet, used only by main thread
+	bool quit;
+};
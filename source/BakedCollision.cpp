@@ -0,0 +1,114 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "BakedCollision.h"
+#include <ostream>
+
+namespace
+{
+	uint Align16(uint offset)
+	{
+		return (offset + 15) & ~15u;
+	}
+}
+
+BakedCollision::BakedCollision() : vert_data(nullptr), index_data(nullptr), vert_count(0), index_count(0), aabb_min(0, 0, 0), aabb_max(0, 0, 0),
+	mesh(nullptr), shape(nullptr)
+{
+}
+
+BakedCollision::~BakedCollision()
+{
+	delete shape;
+	delete mesh;
+}
+
+// append mesh triangles transformed to world space
+void BakedCollision::AddMesh(const VertexData& vd, const Matrix& mat)
+{
+	const int offset = (int)verts.size() / 3;
+	for(const Vec3& v : vd.verts)
+	{
+		const Vec3 pos = Vec3::Transform(v, mat);
+		verts.push_back(pos.x);
+		verts.push_back(pos.y);
+		verts.push_back(pos.z);
+	}
+	for(const VertexData::Face& face : vd.faces)
+	{
+		for(int i = 0; i < 3; ++i)
+			indices.push_back(offset + face.idx[i]);
+	}
+}
+
+// build quantized bvh from added meshes
+void BakedCollision::Build()
+{
+	vert_data = verts.data();
+	index_data = indices.data();
+	vert_count = (uint)verts.size() / 3;
+	index_count = (uint)indices.size();
+	CreateShape(true);
+	shape->getAabb(btTransform::getIdentity(), aabb_min, aabb_max);
+}
+
+void BakedCollision::CreateShape(bool build_bvh)
+{
+	mesh = new btTriangleIndexVertexArray(index_count / 3, index_data, sizeof(int) * 3, vert_count, vert_data, sizeof(btScalar) * 3);
+	if(build_bvh)
+		shape = new btBvhTriangleMeshShape(mesh, true);
+	else
+		shape = new btBvhTriangleMeshShape(mesh, true, aabb_min, aabb_max, false);
+}
+
+// write section, must start at offset aligned to 16 bytes
+void BakedCollision::Write(std::ostream& file) const
+{
+	btOptimizedBvh* bvh = shape->getOptimizedBvh();
+	Header header;
+	header.vert_count = vert_count;
+	header.index_count = index_count;
+	header.bvh_offset = Align16(sizeof(Header) + sizeof(btScalar) * 3 * vert_count + sizeof(int) * index_count);
+	header.bvh_size = bvh->calculateSerializeBufferSize();
+	for(int i = 0; i < 4; ++i)
+	{
+		header.aabb_min[i] = aabb_min.m_floats[i];
+		header.aabb_max[i] = aabb_max.m_floats[i];
+	}
+
+	void* buffer = btAlignedAlloc(header.bvh_size, 16);
+	bvh->serializeInPlace(buffer, header.bvh_size, false);
+
+	const char padding[16] = {};
+	const uint data_size = sizeof(Header) + sizeof(btScalar) * 3 * vert_count + sizeof(int) * index_count;
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)vert_data, sizeof(btScalar) * 3 * vert_count);
+	file.write((const char*)index_data, sizeof(int) * index_count);
+	file.write(padding, header.bvh_offset - data_size);
+	file.write((const char*)buffer, header.bvh_size);
+	btAlignedFree(buffer);
+}
+
+// use section data in place, it must stay mapped while shape is used and be writable (bvh pointers are fixed up in place)
+bool BakedCollision::Map(byte* data, uint size)
+{
+	if(size < sizeof(Header))
+		return false;
+	const Header& header = *(const Header*)data;
+	if(header.bvh_offset + header.bvh_size > size
+		|| sizeof(Header) + sizeof(btScalar) * 3 * header.vert_count + sizeof(int) * header.index_count > header.bvh_offset)
+		return false;
+
+	vert_count = header.vert_count;
+	index_count = header.index_count;
+	vert_data = (btScalar*)(data + sizeof(Header));
+	index_data = (int*)(data + sizeof(Header) + sizeof(btScalar) * 3 * vert_count);
+	aabb_min.setValue(header.aabb_min[0], header.aabb_min[1], header.aabb_min[2]);
+	aabb_max.setValue(header.aabb_max[0], header.aabb_max[1], header.aabb_max[2]);
+
+	btOptimizedBvh* bvh = static_cast<btOptimizedBvh*>(btOptimizedBvh::deSerializeInPlace(data + header.bvh_offset, header.bvh_size, false));
+	if(!bvh)
+		return false;
+	CreateShape(false);
+	shape->setOptimizedBvh(bvh);
+	return true;
+}
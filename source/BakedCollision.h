@@ -0,0 +1,38 @@
+#pragma once
+
+#include <btBulletCollisionCommon.h>
+#include <iosfwd>
+
+// Static triangle mesh collision with quantized bvh. Baked offline from level meshes (-bake) into level file,
+// at runtime vertices, indices and serialized bvh are used in place from mapped file so bvh isn't rebuilt.
+class BakedCollision
+{
+public:
+	BakedCollision();
+	~BakedCollision();
+	void AddMesh(const VertexData& vd, const Matrix& mat);
+	void Build();
+	void Write(std::ostream& file) const;
+	bool Map(byte* data, uint size);
+	btBvhTriangleMeshShape* GetShape() { return shape; }
+	uint GetTriangleCount() const { return index_count / 3; }
+
+private:
+	// section header, followed by vertices, indices and bvh (aligned to 16 bytes)
+	struct Header
+	{
+		uint vert_count, index_count, bvh_offset, bvh_size;
+		btScalar aabb_min[4], aabb_max[4];
+	};
+
+	void CreateShape(bool build_bvh);
+
+	vector<btScalar> verts; // only when baking
+	vector<int> indices;
+	btScalar* vert_data;
+	int* index_data;
+	uint vert_count, index_count;
+	btVector3 aabb_min, aabb_max;
+	btTriangleIndexVertexArray* mesh;
+	btBvhTriangleMeshShape* shape;
+};
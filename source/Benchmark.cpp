@@ -0,0 +1,558 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "Benchmark.h"
+#include "CharacterController.h"
+#include "CharacterControllerSystem.h"
+#include "CmdLine.h"
+#include "CollisionWorld.h"
+#include "FrustumCulling.h"
+#include "Level.h"
+#include "LightClusters.h"
+#include "QualityGovernor.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <fstream>
+
+namespace
+{
+	const float RADIUS = 0.3f;
+	const float HEIGHT = 1.75f;
+	const uint WARMUP_TICKS = 30;
+
+	// deterministic on every platform, unlike std distributions
+	struct Rng
+	{
+		explicit Rng(uint seed) : state(seed) {}
+		uint Next()
+		{
+			state = state * 1664525u + 1013904223u;
+			return state >> 8;
+		}
+		float Get(float a, float b)
+		{
+			return a + (b - a) * float(Next() & 0xFFFF) / 65535.f;
+		}
+		btVector3 GetDir()
+		{
+			const float angle = Get(0, PI * 2);
+			return btVector3(cos(angle), 0, sin(angle));
+		}
+
+		uint state;
+	};
+
+	struct Agent
+	{
+		CharacterController* controller;
+		btVector3 start, dir;
+	};
+
+	struct Scenario
+	{
+		cstring name;
+		void(*create)(Level& level, Rng& rng);
+		void(*spawn)(Agent& agent, Rng& rng);
+		float speed;
+		uint period; // ticks after agent changes direction
+		bool random_turn; // pick random direction instead of reversing
+		float agents_mul;
+	};
+
+	void CreateFloor(Level& level, float size)
+	{
+		level.AddBox(btVector3(size, 0.01f, size), btVector3(0.f, -0.01f, 0.f));
+	}
+
+	//=================================================================================================
+	void CreateFlat(Level& level, Rng& rng)
+	{
+		CreateFloor(level, 25.f);
+	}
+
+	void SpawnFlat(Agent& agent, Rng& rng)
+	{
+		agent.start = btVector3(rng.Get(-10, 10), HEIGHT / 2, rng.Get(-10, 10));
+		agent.dir = rng.GetDir();
+	}
+
+	//=================================================================================================
+	// 10 steps 0.2 high, 0.4 deep going up along x axis, then flat top
+	void CreateStairs(Level& level, Rng& rng)
+	{
+		CreateFloor(level, 25.f);
+		for(int i = 0; i < 10; ++i)
+		{
+			const float h = 0.2f * (i + 1);
+			level.AddBox(btVector3(0.2f, h / 2, 5.f), btVector3(0.2f + 0.4f * i, h / 2, 0.f));
+		}
+		level.AddBox(btVector3(2.f, 1.f, 5.f), btVector3(6.f, 1.f, 0.f));
+	}
+
+	void SpawnStairs(Agent& agent, Rng& rng)
+	{
+		agent.start = btVector3(rng.Get(-3, -1), HEIGHT / 2, rng.Get(-4, 4));
+		agent.dir = btVector3(1, 0, 0);
+	}
+
+	//=================================================================================================
+	// ramp rising along x axis at 45 degrees
+	void CreateSlope(Level& level, Rng& rng)
+	{
+		CreateFloor(level, 25.f);
+		btTransform transform;
+		transform.setIdentity();
+		transform.setRotation(btQuaternion(btVector3(0, 0, 1), PI / 4));
+		transform.setOrigin(btVector3(4.f, 0.f, 0.f));
+		level.AddBox(btVector3(4.f, 0.1f, 5.f), transform);
+	}
+
+	void SpawnSlope(Agent& agent, Rng& rng)
+	{
+		agent.start = btVector3(rng.Get(-3, -1), HEIGHT / 2, rng.Get(-4, 4));
+		agent.dir = btVector3(1, 0, 0);
+	}
+
+	//=================================================================================================
+	// walls meeting at (4,4), agents push into corner and scrape along walls
+	void CreateCorner(Level& level, Rng& rng)
+	{
+		CreateFloor(level, 25.f);
+		level.AddBox(btVector3(8.f, 1.5f, 0.1f), btVector3(-4.f, 1.5f, 4.1f));
+		level.AddBox(btVector3(0.1f, 1.5f, 8.f), btVector3(4.1f, 1.5f, -4.f));
+	}
+
+	void SpawnCorner(Agent& agent, Rng& rng)
+	{
+		agent.start = btVector3(rng.Get(0, 3), HEIGHT / 2, rng.Get(0, 3));
+		agent.dir = btVector3(1, 0, 1).normalized();
+	}
+
+	//=================================================================================================
+	// 500 random boxes on 30x30 area
+	void CreateProps(Level& level, Rng& rng)
+	{
+		CreateFloor(level, 25.f);
+		for(int i = 0; i < 500; ++i)
+		{
+			const btVector3 half_extents(rng.Get(0.1f, 0.5f), rng.Get(0.1f, 0.6f), rng.Get(0.1f, 0.5f));
+			btTransform transform;
+			transform.setIdentity();
+			transform.setRotation(btQuaternion(btVector3(0, 1, 0), rng.Get(0, PI)));
+			transform.setOrigin(btVector3(rng.Get(-15, 15), half_extents.y(), rng.Get(-15, 15)));
+			level.AddBox(half_extents, transform);
+		}
+	}
+
+	void SpawnProps(Agent& agent, Rng& rng)
+	{
+		agent.start = btVector3(rng.Get(-12, 12), 1.2f + HEIGHT / 2, rng.Get(-12, 12));
+		agent.dir = rng.GetDir();
+	}
+
+	//=================================================================================================
+	// rolling hills heightfield 40x40, ground is found analytically
+	float GetHillsHeight(float x, float z)
+	{
+		return sin(x * 0.3f) * cos(z * 0.25f) * 1.5f + sin(x * 0.9f + z * 0.7f) * 0.2f;
+	}
+
+	void CreateTerrain(Level& level, Rng& rng)
+	{
+		const uint size = 80;
+		const float cell_size = 0.5f;
+		vector<float> heights((size + 1) * (size + 1));
+		for(uint z = 0; z <= size; ++z)
+		{
+			for(uint x = 0; x <= size; ++x)
+				heights[x + z * (size + 1)] = GetHillsHeight(cell_size * x - 20.f, cell_size * z - 20.f);
+		}
+		level.AddTerrain(size, size, cell_size, heights.data());
+	}
+
+	void SpawnTerrain(Agent& agent, Rng& rng)
+	{
+		const float x = rng.Get(-15, 15), z = rng.Get(-15, 15);
+		agent.start = btVector3(x, GetHillsHeight(x, z) + HEIGHT / 2 + 0.1f, z);
+		agent.dir = rng.GetDir();
+	}
+
+	//=================================================================================================
+	// agents spawned on each other in small area
+	void SpawnCapsules(Agent& agent, Rng& rng)
+	{
+		agent.start = btVector3(rng.Get(-1.5f, 1.5f), HEIGHT / 2, rng.Get(-1.5f, 1.5f));
+		agent.dir = rng.GetDir();
+	}
+
+	const Scenario scenarios[] = {
+		{ "flat", CreateFlat, SpawnFlat, 5.f, 120, false, 1.f },
+		{ "stairs", CreateStairs, SpawnStairs, 3.f, 150, false, 1.f },
+		{ "slope", CreateSlope, SpawnSlope, 3.f, 150, false, 1.f },
+		{ "corner", CreateCorner, SpawnCorner, 5.f, 240, false, 1.f },
+		{ "props", CreateProps, SpawnProps, 5.f, 60, true, 1.f },
+		{ "capsules", CreateFlat, SpawnCapsules, 2.f, 30, false, 2.f },
+		{ "terrain", CreateTerrain, SpawnTerrain, 5.f, 120, true, 1.f }
+	};
+
+	struct Result
+	{
+		cstring name;
+		CharacterController::GroundMode ground;
+		uint agents, updates;
+		double total_ms, ns_per_update, sweeps_per_update, rays_per_update, penetration_per_update, dispatches_per_update;
+		uint64 checksum; // hash of final positions, must be same for any thread count
+	};
+
+	uint64 HashPositions(const vector<Agent>& agents)
+	{
+		uint64 hash = 14695981039346656037ull;
+		for(const Agent& agent : agents)
+		{
+			const btVector3& pos = agent.controller->getPos();
+			const byte* data = reinterpret_cast<const byte*>(pos.m_floats);
+			for(uint i = 0; i < sizeof(btScalar) * 3; ++i)
+				hash = (hash ^ data[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	cstring GetGroundName(CharacterController::GroundMode ground)
+	{
+		return ground == CharacterController::GROUND_RAYS ? "rays" : "sweep";
+	}
+
+	Result Run(const Scenario& scenario, uint agents_count, uint ticks, uint seed, ThreadPool* pool, CharacterController::GroundMode ground)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		Rng rng(seed);
+		CollisionWorld world;
+		Level level(world.Get());
+		scenario.create(level, rng);
+		CharacterControllerSystem controllers(world.Get());
+		controllers.SetThreadPool(pool);
+
+		agents_count = uint(agents_count * scenario.agents_mul);
+		vector<Agent> agents(agents_count);
+		for(Agent& agent : agents)
+		{
+			scenario.spawn(agent, rng);
+			agent.controller = controllers.Add(RADIUS, HEIGHT);
+			agent.controller->setLinearDamping(10.f);
+			agent.controller->setGroundMode(ground);
+			agent.controller->warp(agent.start);
+		}
+
+		Clock::duration time = Clock::duration::zero();
+		for(uint tick = 0; tick < WARMUP_TICKS + ticks; ++tick)
+		{
+#if CC_COUNTERS
+			if(tick == WARMUP_TICKS)
+			{
+				for(Agent& agent : agents)
+					agent.controller->resetStats();
+			}
+#endif
+
+			for(Agent& agent : agents)
+			{
+				if(tick % scenario.period == 0 && tick != 0)
+					agent.dir = scenario.random_turn ? rng.GetDir() : -agent.dir;
+				if(agent.controller->getPos().y() < -5.f)
+				{
+					agent.controller->reset();
+					agent.controller->warp(agent.start);
+				}
+				agent.controller->setWalkDirection(agent.dir * scenario.speed);
+			}
+
+			Clock::time_point start = Clock::now();
+			controllers.Update(TICK);
+			if(tick >= WARMUP_TICKS)
+				time += Clock::now() - start;
+		}
+
+		uint64 sweeps = 0, rays = 0, penetration_loops = 0, dispatches = 0;
+#if CC_COUNTERS
+		for(Agent& agent : agents)
+		{
+			const CharacterController::Stats& stats = agent.controller->getTotalStats();
+			sweeps += stats.GetSweeps();
+			rays += stats.rays_down;
+			penetration_loops += stats.penetration_loops;
+			dispatches += stats.dispatches;
+		}
+#endif
+
+		Result result;
+		result.name = scenario.name;
+		result.ground = ground;
+		result.agents = agents_count;
+		result.updates = agents_count * ticks;
+		result.total_ms = std::chrono::duration<double, std::milli>(time).count();
+		result.ns_per_update = std::chrono::duration<double, std::nano>(time).count() / result.updates;
+		result.sweeps_per_update = double(sweeps) / result.updates;
+		result.rays_per_update = double(rays) / result.updates;
+		result.penetration_per_update = double(penetration_loops) / result.updates;
+		result.dispatches_per_update = double(dispatches) / result.updates;
+		result.checksum = HashPositions(agents);
+		return result;
+	}
+
+	//=================================================================================================
+	// Culls random props with camera rotating in place, SSE kernel must give same visible lists as scalar one
+	int RunCulling(const CmdLine& cmd)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		const uint nodes = (uint)cmd.GetInt("nodes", 50000);
+		const uint frames = (uint)cmd.GetInt("updates", 600);
+		Rng rng((uint)cmd.GetInt("seed", 1));
+		FrustumCulling culling;
+		culling.Reserve(nodes);
+		for(uint i = 0; i < nodes; ++i)
+			culling.Add(Vec3(rng.Get(-200, 200), rng.Get(0, 5), rng.Get(-200, 200)), rng.Get(0.2f, 3.f));
+
+		const Matrix proj = Matrix::CreatePerspectiveFieldOfView(PI / 4, 16.f / 9, 0.1f, 150.f);
+		vector<uint64> hashes[2];
+		double ms[2];
+		uint visible = 0;
+		for(uint pass = 0; pass < 2; ++pass)
+		{
+			Clock::duration time = Clock::duration::zero();
+			hashes[pass].resize(frames);
+			for(uint frame = 0; frame < frames; ++frame)
+			{
+				const float angle = PI * 2 * frame / frames;
+				const Vec3 from(0, 2, 0);
+				culling.SetFrustum(Matrix::CreateLookAt(from, from + Vec3(cos(angle), -0.1f, sin(angle))) * proj);
+				Clock::time_point start = Clock::now();
+				if(pass == 0)
+					culling.CullScalar();
+				else
+					culling.Cull();
+				time += Clock::now() - start;
+
+				uint64 hash = 14695981039346656037ull;
+				for(uint index : culling.GetVisible())
+					hash = (hash ^ index) * 1099511628211ull;
+				hashes[pass][frame] = hash;
+				visible += (uint)culling.GetVisible().size();
+			}
+			ms[pass] = std::chrono::duration<double, std::milli>(time).count();
+		}
+
+		Info(Format("Bench culling: %u nodes, %u frames, avg %u visible, scalar %.3f ms/frame, sse %.3f ms/frame (%.2fx), %.2f ns/node.",
+			nodes, frames, visible / (frames * 2), ms[0] / frames, ms[1] / frames, ms[0] / ms[1], ms[1] * 1000000 / frames / nodes));
+		if(hashes[0] != hashes[1])
+		{
+			Error("Bench culling: SSE result differs from scalar.");
+			return 1;
+		}
+		return 0;
+	}
+
+	//=================================================================================================
+	// Bins random moving lights, result must match brute force reference and be same for any thread count
+	int RunLights(const CmdLine& cmd)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		const uint count = (uint)cmd.GetInt("lights", 256);
+		const uint frames = (uint)cmd.GetInt("updates", 600);
+		const uint threads = Max((uint)cmd.GetInt("threads", 1), 1u);
+		Rng rng((uint)cmd.GetInt("seed", 1));
+		vector<LightClusters::Light> lights(count);
+		vector<Vec3> velocities(count);
+		for(uint i = 0; i < count; ++i)
+		{
+			lights[i].pos = Vec3(rng.Get(-50, 50), rng.Get(0, 5), rng.Get(-50, 50));
+			lights[i].range = rng.Get(1.f, 8.f);
+			velocities[i] = Vec3(rng.Get(-2, 2), 0, rng.Get(-2, 2));
+		}
+
+		ThreadPool* pool = threads > 1 ? new ThreadPool(threads) : nullptr;
+		LightClusters clusters(16, 9, 24), reference(16, 9, 24);
+		clusters.SetCamera(Vec3(0, 2, -60), Vec3(0, 0, 0), Vec3(0, 1, 0), PI / 4, 16.f / 9, 0.1f, 150.f);
+		reference.SetCamera(Vec3(0, 2, -60), Vec3(0, 0, 0), Vec3(0, 1, 0), PI / 4, 16.f / 9, 0.1f, 150.f);
+		Clock::duration time = Clock::duration::zero();
+		uint64 assigned = 0;
+		uint mismatches = 0;
+		for(uint frame = 0; frame < frames; ++frame)
+		{
+			for(uint i = 0; i < count; ++i)
+				lights[i].pos += velocities[i] * TICK;
+
+			Clock::time_point start = Clock::now();
+			clusters.Build(lights, pool);
+			time += Clock::now() - start;
+			assigned += clusters.GetLightIndices().size();
+
+			reference.BuildReference(lights);
+			bool same = clusters.GetLightIndices() == reference.GetLightIndices();
+			for(uint i = 0; i < clusters.GetClusterCount() && same; ++i)
+				same = clusters.GetCluster(i).offset == reference.GetCluster(i).offset && clusters.GetCluster(i).count == reference.GetCluster(i).count;
+			if(!same)
+				++mismatches;
+		}
+		delete pool;
+
+		const double ms = std::chrono::duration<double, std::milli>(time).count();
+		Info(Format("Bench lights: %u lights, %u clusters, %u threads, %.3f ms/frame, avg %.1f lights/used cluster, %.1f clusters/light.",
+			count, clusters.GetClusterCount(), threads, ms / frames, clusters.GetUsedClusterCount() ? double(clusters.GetLightIndices().size())
+			/ clusters.GetUsedClusterCount() : 0., count ? double(assigned) / frames / count : 0.));
+		if(mismatches)
+		{
+			Error(Format("Bench lights: Result differs from reference in %u frames.", mismatches));
+			return 1;
+		}
+		return 0;
+	}
+
+	//=================================================================================================
+	// Feeds quality governor with synthetic frame times (cost depends on current level), checks it settles on expected
+	// level without oscillating and ignores single hitches
+	int RunQuality(const CmdLine& cmd)
+	{
+		struct Scenario
+		{
+			cstring name;
+			float duration;
+			uint level, max_changes; // expected final level & max level changes
+			std::function<float(float time, uint level)> cost; // work time
+			bool vsync; // frame time is rounded up to multiple of target
+		};
+
+		const uint STEPS = 6;
+		const Scenario scenarios[] = {
+			{ "light", 60.f, 0, 0, [](float, uint) { return 0.01f; }, false },
+			{ "heavy", 60.f, 3, 3, [](float, uint level) { return 0.024f * (1.f - 0.1f * level); }, false },
+			{ "edge", 120.f, 1, 12, [](float, uint level) { return level == 0 ? 0.024f : 0.011f; }, false },
+			{ "hitches", 60.f, 0, 0, [](float time, uint) { return fmod(time, 5.f) < 0.01f ? 0.5f : 0.01f; }, false },
+			{ "recovery", 60.f, 0, 6, [](float time, uint level) { return (time < 20.f ? 0.024f : 0.008f) * (1.f - 0.1f * level); }, false },
+			// frame time is pinned at target after load drops, quality must still come back
+			{ "vsync", 60.f, 0, 12, [](float time, uint level) { return (time < 10.f ? 0.024f : 0.008f) * (1.f - 0.1f * level); }, true }
+		};
+
+		Rng rng((uint)cmd.GetInt("seed", 1));
+		uint failed = 0;
+		for(const Scenario& scenario : scenarios)
+		{
+			const float target = 1.f / 60;
+			QualityGovernor governor(target);
+			for(uint i = 0; i < STEPS; ++i)
+				governor.AddStep("step", [](bool) {});
+			float time = 0;
+			uint changes = 0;
+			while(time < scenario.duration)
+			{
+				const float work_time = scenario.cost(time, governor.GetLevel()) * rng.Get(0.9f, 1.1f);
+				const float frame_time = scenario.vsync ? ceil(work_time / target) * target : work_time;
+				if(governor.Update(frame_time, work_time) != 0)
+					++changes;
+				time += frame_time;
+			}
+			const bool ok = governor.GetLevel() == scenario.level && changes <= scenario.max_changes;
+			Info(Format("Bench quality: %s, level %u (expected %u), %u changes (max %u)%s", scenario.name, governor.GetLevel(),
+				scenario.level, changes, scenario.max_changes, ok ? "" : " FAILED"));
+			if(!ok)
+				++failed;
+		}
+		if(failed)
+		{
+			Error(Format("Bench quality: %u scenarios failed.", failed));
+			return 1;
+		}
+		return 0;
+	}
+}
+
+int Benchmark::Main(const CmdLine& cmd)
+{
+	Logger::SetInstance(new ConsoleLogger);
+	if(cmd.Has("cull"))
+		return RunCulling(cmd);
+	if(cmd.Has("lights"))
+		return RunLights(cmd);
+	if(cmd.Has("quality"))
+		return RunQuality(cmd);
+#if !CC_COUNTERS
+	Warn("Bench: Built without CC_BENCH_COUNTERS (msbuild /p:BenchCounters=true), sweep and penetration counts will be zero.");
+#endif
+
+	cstring scenario_name = cmd.Get("scenario");
+	const uint agents = (uint)cmd.GetInt("agents", 32);
+	const uint updates = (uint)cmd.GetInt("updates", 600);
+	const uint seed = (uint)cmd.GetInt("seed", 1);
+	const uint threads = (uint)cmd.GetInt("threads", 1);
+	cstring ground_name = cmd.Get("ground", "sweep");
+	cstring out = cmd.Get("out", "bench.json");
+
+	// compare runs every scenario with sweeps and then with rays
+	const bool compare = strcmp(ground_name, "compare") == 0;
+	const CharacterController::GroundMode ground = strcmp(ground_name, "rays") == 0 ? CharacterController::GROUND_RAYS : CharacterController::GROUND_SWEEP;
+	if(!compare && ground == CharacterController::GROUND_SWEEP && strcmp(ground_name, "sweep") != 0)
+	{
+		Error(Format("Bench: Unknown ground mode '%s'.", ground_name));
+		return 1;
+	}
+
+	ThreadPool* pool = threads > 1 ? new ThreadPool(threads) : nullptr;
+	vector<Result> results;
+	bool deterministic = true;
+	for(const Scenario& scenario : scenarios)
+	{
+		if(scenario_name && strcmp(scenario_name, scenario.name) != 0)
+			continue;
+		const Result result = Run(scenario, agents, updates, seed, pool, ground);
+		Info(Format("Bench %s (%s): %u agents, %.1f ns/update, %.2f sweeps/update, %.2f rays/update, %.2f penetration/update, %.2f dispatches/update, %.2f ms total.",
+			result.name, GetGroundName(ground), result.agents, result.ns_per_update, result.sweeps_per_update, result.rays_per_update,
+			result.penetration_per_update, result.dispatches_per_update, result.total_ms));
+		if(pool)
+		{
+			// parallel update must give same positions as single threaded
+			const Result serial = Run(scenario, agents, updates, seed, nullptr, ground);
+			Info(Format("Bench %s: %u threads %.2fx faster than serial.", result.name, threads, serial.total_ms / result.total_ms));
+			if(serial.checksum != result.checksum)
+			{
+				Error(Format("Bench %s: Parallel result differs from serial.", result.name));
+				deterministic = false;
+			}
+		}
+		results.push_back(result);
+
+		if(compare)
+		{
+			const Result rays = Run(scenario, agents, updates, seed, pool, CharacterController::GROUND_RAYS);
+			Info(Format("Bench %s (rays): %.1f ns/update (%.2fx of sweep), %.2f sweeps/update, %.2f rays/update.", rays.name, rays.ns_per_update,
+				rays.ns_per_update / result.ns_per_update, rays.sweeps_per_update, rays.rays_per_update));
+			results.push_back(rays);
+		}
+	}
+	delete pool;
+
+	if(results.empty())
+	{
+		Error(Format("Bench: Unknown scenario '%s'.", scenario_name));
+		return 1;
+	}
+
+	std::ofstream file(out);
+	if(!file)
+	{
+		Error(Format("Bench: Failed to open '%s'.", out));
+		return 1;
+	}
+	file << "{\n\t\"seed\": " << seed << ",\n\t\"threads\": " << threads << ",\n\t\"scenarios\": [\n";
+	for(uint i = 0; i < results.size(); ++i)
+	{
+		const Result& r = results[i];
+		file << "\t\t{ \"name\": \"" << r.name << "\", \"ground\": \"" << GetGroundName(r.ground) << "\", \"agents\": " << r.agents << ", \"updates\": " << r.updates
+			<< ", \"ns_per_update\": " << r.ns_per_update << ", \"sweeps_per_update\": " << r.sweeps_per_update << ", \"rays_per_update\": " << r.rays_per_update
+			<< ", \"penetration_per_update\": " << r.penetration_per_update << ", \"dispatches_per_update\": " << r.dispatches_per_update << ", \"total_ms\": " << r.total_ms
+			<< ", \"checksum\": \"" << Format("%016llx", r.checksum) << "\" }"
+			<< (i + 1 == results.size() ? "\n" : ",\n");
+	}
+	file << "\t]\n}\n";
+	return deterministic ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// Benchmark of CharacterController::update in representative collision worlds
+// -bench [-scenario name] [-agents count] [-updates count] [-seed seed] [-threads count] [-ground sweep|rays|compare] [-out path]
+// results are logged and saved as json (default bench.json), sweep & penetration counts require CC_BENCH_COUNTERS (debug or release built with /p:BenchCounters=true)
+// with more than 1 thread each scenario is also run serially and final positions must match
+// compare runs every scenario again with ray ground probes (-scenario stairs / slope shows cost difference)
+// -bench -cull [-nodes count] [-updates count] [-seed seed] checks frustum culling kernel against scalar version
+// -bench -lights count [-updates count] [-threads count] [-seed seed] checks clustered light binning against brute force
+// -bench -quality [-seed seed] runs quality governor on synthetic frame time traces
+class Benchmark
+{
+public:
+	static int Main(const CmdLine& cmd);
+};
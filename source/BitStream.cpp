@@ -0,0 +1,55 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "BitStream.h"
+
+void BitWriter::Clear()
+{
+	data.clear();
+	scratch = 0;
+	scratch_bits = 0;
+	bits = 0;
+}
+
+void BitWriter::Write(uint value, uint count)
+{
+	const uint64 mask = (uint64(1) << count) - 1;
+	scratch |= (uint64(value) & mask) << scratch_bits;
+	scratch_bits += count;
+	bits += count;
+	while(scratch_bits >= 8)
+	{
+		data.push_back(byte(scratch));
+		scratch >>= 8;
+		scratch_bits -= 8;
+	}
+}
+
+void BitWriter::Flush()
+{
+	if(scratch_bits > 0)
+	{
+		data.push_back(byte(scratch));
+		scratch = 0;
+		scratch_bits = 0;
+	}
+}
+
+uint BitReader::Read(uint count)
+{
+	while(scratch_bits < count && pos < size)
+	{
+		scratch |= uint64(data[pos++]) << scratch_bits;
+		scratch_bits += 8;
+	}
+	if(scratch_bits < count)
+	{
+		error = true;
+		scratch = 0;
+		scratch_bits = 0;
+		return 0;
+	}
+	const uint value = uint(scratch & ((uint64(1) << count) - 1));
+	scratch >>= count;
+	scratch_bits -= count;
+	return value;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// Packs values with given bit count into bytes, least significant bits first.
+class BitWriter
+{
+public:
+	BitWriter() : scratch(0), scratch_bits(0), bits(0) {}
+	void Clear();
+	void Write(uint value, uint count); // count in [1,32]
+	void WriteBit(bool value) { Write(value ? 1u : 0u, 1); }
+	void Flush(); // writes partial byte, call before GetData
+	const vector<byte>& GetData() const { return data; }
+	uint GetBits() const { return bits; }
+
+private:
+	vector<byte> data;
+	uint64 scratch;
+	uint scratch_bits, bits;
+};
+
+// Reads values written by BitWriter. Reading past end returns zeros and sets error.
+class BitReader
+{
+public:
+	BitReader(const byte* data, uint size) : data(data), size(size), pos(0), scratch(0), scratch_bits(0), error(false) {}
+	uint Read(uint count);
+	bool ReadBit() { return Read(1) != 0; }
+	bool HaveError() const { return error; }
+
+private:
+	const byte* data;
+	uint size, pos;
+	uint64 scratch;
+	uint scratch_bits;
+	bool error;
+};
@@ -1,8 +1,32 @@
 #include "Pch.h"
 #include "GameCore.h"
 #include "CharacterController.h"
-#include <Physics.h>
+#include "CharacterControllerSystem.h"
+#include "Trace.h"
+#include "Terrain.h"
 #include <BulletCollision\CollisionDispatch\btGhostObject.h>
+#if CC_COUNTERS
+#define CC_STAT(x) x
+#else
+#define CC_STAT(x)
+#endif
+#if CC_PROFILE
+#include <chrono>
+
+// adds elapsed seconds to value on scope exit
+struct ProfileTimer
+{
+	explicit ProfileTimer(float& value) : value(value), start(std::chrono::high_resolution_clock::now()) {}
+	~ProfileTimer() { value += std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count(); }
+
+	float& value;
+	std::chrono::high_resolution_clock::time_point start;
+};
+
+#define CC_TIMER(var) ProfileTimer timer_##var(m_stats.var)
+#else
+#define CC_TIMER(var)
+#endif
 
 // static helper method
 static btVector3 getNormalizedVector(const btVector3& v)
@@ -35,6 +59,25 @@ btVector3 perpindicularComponent(const btVector3& direction, const btVector3& no
 	return direction - parallelComponent(direction, normal);
 }
 
+class btKinematicClosestNotMeRayResultCallback : public btCollisionWorld::ClosestRayResultCallback
+{
+public:
+	btKinematicClosestNotMeRayResultCallback(btCollisionObject* me, const btVector3& from, const btVector3& to)
+		: btCollisionWorld::ClosestRayResultCallback(from, to), m_me(me)
+	{
+	}
+
+	virtual btScalar addSingleResult(btCollisionWorld::LocalRayResult& rayResult, bool normalInWorldSpace)
+	{
+		if(rayResult.m_collisionObject == m_me || !rayResult.m_collisionObject->hasContactResponse())
+			return btScalar(1.0);
+		return ClosestRayResultCallback::addSingleResult(rayResult, normalInWorldSpace);
+	}
+
+protected:
+	btCollisionObject* m_me;
+};
+
 class btKinematicClosestNotMeConvexResultCallback : public btCollisionWorld::ClosestConvexResultCallback
 {
 public:
@@ -77,43 +120,89 @@ protected:
 	btScalar m_minSlopeDot;
 };
 
-CharacterController::CharacterController(float radius, float height)
+inline btVector3& CharacterController::currentPosition()
+{
+	return system->positions[index];
+}
+
+inline btScalar& CharacterController::verticalVelocity()
+{
+	return system->vertical_velocities[index];
+}
+
+inline const btVector3& CharacterController::walkDirection() const
+{
+	return system->walk_directions[index];
+}
+
+inline btVector3& CharacterController::horizontalVelocity()
+{
+	return system->horizontal_velocities[index];
+}
+
+inline btVector3& CharacterController::targetPosition()
+{
+	return system->target_positions[index];
+}
+
+inline btScalar& CharacterController::stepOffset()
+{
+	return system->step_offsets[index];
+}
+
+inline btScalar& CharacterController::verticalOffset()
+{
+	return system->vertical_offsets[index];
+}
+
+inline int& CharacterController::idleTicks()
+{
+	return system->idle_ticks[index];
+}
+
+inline byte& CharacterController::hotFlags()
+{
+	return system->flags[index];
+}
+
+inline bool CharacterController::wasOnGround() const
 {
-	world = app::physics->GetWorld();
+	return IsSet(system->flags[index], CharacterControllerSystem::F_ON_GROUND);
+}
 
-	ghost_callback = new btGhostPairCallback;
-	world->getPairCache()->setInternalGhostPairCallback(ghost_callback);
+inline bool CharacterController::isJumping() const
+{
+	return IsSet(system->flags[index], CharacterControllerSystem::F_JUMPING);
+}
 
-	btCapsuleShape* shape = new btCapsuleShape(radius, height - radius * 2);
-	app::physics->AddShape(shape);
+CharacterController::CharacterController(CharacterControllerSystem* system, uint index, btConvexShape* shape, float height)
+	: system(system), index(index)
+{
+	world = system->GetWorld();
 
 	m_ghostObject = new btPairCachingGhostObject;
 	m_ghostObject->setCollisionShape(shape);
 	m_ghostObject->getWorldTransform().setOrigin(btVector3(0, height / 2, 0));
 	m_ghostObject->setCollisionFlags(btCollisionObject::CF_KINEMATIC_OBJECT);
+	m_ghostObject->setUserPointer(this);
 	world->addCollisionObject(m_ghostObject);
 
 	m_up.setValue(0.0f, 1.0f, 0.0f);
 	m_jumpAxis.setValue(0.0f, 1.0f, 0.0f);
 	m_addedMargin = 0.02f;
-	m_walkDirection.setValue(0.0, 0.0, 0.0);
 	m_useGhostObjectSweepTest = true;
 	m_convexShape = shape;
 	m_velocityTimeInterval = 0.0;
-	m_verticalVelocity = 0.0;
-	m_verticalOffset = 0.0;
 	m_gravity = G * 3;  // 3G acceleration.
 	m_fallSpeed = 55.0;     // Terminal velocity of a sky diver in m/s.
 	m_jumpSpeed = 11.0f;     // ?
 	m_SetjumpSpeed = m_jumpSpeed;
-	m_wasOnGround = false;
-	m_wasJumping = false;
 	m_interpolateUp = true;
-	m_currentStepOffset = 0.0;
 	m_maxPenetrationDepth = 0.2f;
 	m_linearDamping = btScalar(0.0);
-	m_horizontalVelocity.setValue(0, 0, 0);
 	prevent_fall = false;
+	m_groundMode = GROUND_SWEEP;
+	m_residualPenetration = 0;
 
 	setUp(btVector3(0, 1, 0));
 	setStepHeight(0.3f);
@@ -123,40 +212,60 @@ CharacterController::CharacterController(float radius, float height)
 CharacterController::~CharacterController()
 {
 	world->removeCollisionObject(m_ghostObject);
-	world->getPairCache()->setInternalGhostPairCallback(nullptr);
-	delete ghost_callback;
 	delete m_ghostObject;
 }
 
-bool CharacterController::recoverFromPenetration()
+// Here we must refresh the overlapping paircache as the penetrating movement itself or the
+// previous recovery pass might have used setWorldTransform and pushed us into an object
+// that is not in the previous cache contents from the last timestep, as will happen if we
+// are pushed into a new AABB overlap. Unhandled this means the next convex sweep gets stuck.
+//
+// Do this by calling the broadphase's setAabb with the moved AABB, this will update the broadphase
+// paircache and the ghostobject's internal paircache at the same time.    /BW
+void CharacterController::updateAabb()
 {
-	// Here we must refresh the overlapping paircache as the penetrating movement itself or the
-	// previous recovery iteration might have used setWorldTransform and pushed us into an object
-	// that is not in the previous cache contents from the last timestep, as will happen if we
-	// are pushed into a new AABB overlap. Unhandled this means the next convex sweep gets stuck.
-	//
-	// Do this by calling the broadphase's setAabb with the moved AABB, this will update the broadphase
-	// paircache and the ghostobject's internal paircache at the same time.    /BW
-
 	btVector3 minAabb, maxAabb;
 	m_convexShape->getAabb(m_ghostObject->getWorldTransform(), minAabb, maxAabb);
 	world->getBroadphase()->setAabb(m_ghostObject->getBroadphaseHandle(),
 		minAabb,
 		maxAabb,
 		world->getDispatcher());
+}
 
-	bool penetration = false;
+// Single narrowphase dispatch, collects contacts deeper than allowed penetration as push out normal & depth to remove.
+// Contacts with almost same normal are merged (deepest is kept). Returns true if any found.
+// Manifolds are cleared before dispatch and contacts are sorted, so result depends only on current position and not on
+// contacts cached in previous updates or pair cache order (restored snapshot resimulates same way).
+bool CharacterController::gatherPenetrations()
+{
+	updateAabb();
+
+	btOverlappingPairCache* pairCache = m_ghostObject->getOverlappingPairCache();
+	for(int i = 0; i < pairCache->getNumOverlappingPairs(); i++)
+	{
+		btBroadphasePair& collisionPair = pairCache->getOverlappingPairArray()[i];
+		if(collisionPair.m_algorithm)
+		{
+			m_manifoldArray.resize(0);
+			collisionPair.m_algorithm->getAllContactManifolds(m_manifoldArray);
+			for(int j = 0; j < m_manifoldArray.size(); j++)
+				m_manifoldArray[j]->clearManifold();
+		}
+	}
 
-	world->getDispatcher()->dispatchAllCollisionPairs(m_ghostObject->getOverlappingPairCache(), world->getDispatchInfo(), world->getDispatcher());
+	CC_STAT(++m_stats.dispatches);
+	world->getDispatcher()->dispatchAllCollisionPairs(pairCache, world->getDispatchInfo(), world->getDispatcher());
 
-	m_currentPosition = m_ghostObject->getWorldTransform().getOrigin();
+	currentPosition() = m_ghostObject->getWorldTransform().getOrigin();
+	m_contacts.resize(0);
+	m_penetrationNormals.resize(0);
+	m_penetrationDepths.resize(0);
 
-	//	btScalar maxPen = btScalar(0.0);
-	for(int i = 0; i < m_ghostObject->getOverlappingPairCache()->getNumOverlappingPairs(); i++)
+	for(int i = 0; i < pairCache->getNumOverlappingPairs(); i++)
 	{
 		m_manifoldArray.resize(0);
 
-		btBroadphasePair* collisionPair = &m_ghostObject->getOverlappingPairCache()->getOverlappingPairArray()[i];
+		btBroadphasePair* collisionPair = &pairCache->getOverlappingPairArray()[i];
 
 		btCollisionObject* obj0 = static_cast<btCollisionObject*>(collisionPair->m_pProxy0->m_clientObject);
 		btCollisionObject* obj1 = static_cast<btCollisionObject*>(collisionPair->m_pProxy1->m_clientObject);
@@ -173,7 +282,7 @@ bool CharacterController::recoverFromPenetration()
 		for(int j = 0; j < m_manifoldArray.size(); j++)
 		{
 			btPersistentManifold* manifold = m_manifoldArray[j];
-			btScalar directionSign = manifold->getBody0() == m_ghostObject ? btScalar(-1.0) : btScalar(1.0);
+			btScalar directionSign = manifold->getBody0() == m_ghostObject ? btScalar(1.0) : btScalar(-1.0);
 			for(int p = 0; p < manifold->getNumContacts(); p++)
 			{
 				const btManifoldPoint& pt = manifold->getContactPoint(p);
@@ -182,22 +291,108 @@ bool CharacterController::recoverFromPenetration()
 
 				if(dist < -m_maxPenetrationDepth)
 				{
-					m_currentPosition += pt.m_normalWorldOnB * directionSign * dist * btScalar(0.2);
-					penetration = true;
+					Penetration& contact = m_contacts.expandNonInitializing();
+					contact.normal = pt.m_normalWorldOnB * directionSign;
+					contact.depth = -dist - m_maxPenetrationDepth;
 				}
 			}
 		}
 	}
-	btTransform newTrans = m_ghostObject->getWorldTransform();
-	newTrans.setOrigin(m_currentPosition);
-	m_ghostObject->setWorldTransform(newTrans);
+	if(m_contacts.size() == 0)
+		return false;
+
+	// deepest first, so it is kept as normal of merged contacts
+	struct PenetrationLess
+	{
+		bool operator()(const Penetration& a, const Penetration& b) const
+		{
+			if(a.depth != b.depth)
+				return a.depth > b.depth;
+			if(a.normal.x() != b.normal.x())
+				return a.normal.x() < b.normal.x();
+			if(a.normal.y() != b.normal.y())
+				return a.normal.y() < b.normal.y();
+			return a.normal.z() < b.normal.z();
+		}
+	};
+	m_contacts.quickSort(PenetrationLess());
+
+	for(int i = 0; i < m_contacts.size(); i++)
+	{
+		const Penetration& contact = m_contacts[i];
+		int k = 0;
+		for(; k < m_penetrationNormals.size(); k++)
+		{
+			if(m_penetrationNormals[k].dot(contact.normal) > btScalar(0.99))
+				break;
+		}
+		if(k == m_penetrationNormals.size())
+		{
+			m_penetrationNormals.push_back(contact.normal);
+			m_penetrationDepths.push_back(contact.depth);
+		}
+	}
+	return true;
+}
+
+// Minimal translation that removes all gathered penetrations (projected Gauss-Seidel over contact planes,
+// corners with few planes converge in couple iterations). Residual is depth left after correction.
+btVector3 CharacterController::solvePenetration(btScalar& residual) const
+{
+	btVector3 correction(0, 0, 0);
+	for(int iter = 0; iter < 8; iter++)
+	{
+		bool changed = false;
+		for(int i = 0; i < m_penetrationNormals.size(); i++)
+		{
+			const btScalar missing = m_penetrationDepths[i] - correction.dot(m_penetrationNormals[i]);
+			if(missing > SIMD_EPSILON)
+			{
+				correction += m_penetrationNormals[i] * missing;
+				changed = true;
+			}
+		}
+		if(!changed)
+			break;
+	}
+
+	residual = 0;
+	for(int i = 0; i < m_penetrationNormals.size(); i++)
+		residual = btMax(residual, m_penetrationDepths[i] - correction.dot(m_penetrationNormals[i]));
+	return correction;
+}
+
+// Moves controller out of penetration with combined correction of all contacts, at most two narrowphase passes
+// (second one catches contacts with objects that correction moved into). Returns true if was penetrating,
+// depth that couldn't be resolved is in m_residualPenetration.
+bool CharacterController::resolvePenetration()
+{
+	bool penetration = false;
+	m_residualPenetration = 0;
+	for(int pass = 0; pass < 2; pass++)
+	{
+		if(!gatherPenetrations())
+		{
+			m_residualPenetration = 0;
+			return penetration;
+		}
+		penetration = true;
+		CC_STAT(++m_stats.penetration_loops);
+		currentPosition() += solvePenetration(m_residualPenetration);
+		btTransform newTrans = m_ghostObject->getWorldTransform();
+		newTrans.setOrigin(currentPosition());
+		m_ghostObject->setWorldTransform(newTrans);
+	}
+	updateAabb();
 	return penetration;
 }
 
-void CharacterController::stepUp()
+// returns false if hit something and penetration recovery is required but not allowed
+bool CharacterController::stepUp(bool allowRecover)
 {
+	CC_TIMER(time_up);
 	btScalar stepHeight = 0.0f;
-	if(m_verticalVelocity < 0.0)
+	if(verticalVelocity() < 0.0)
 		stepHeight = m_stepHeight;
 
 	// phase 1: up
@@ -207,12 +402,12 @@ void CharacterController::stepUp()
 	end.setIdentity();
 
 	/* FIXME: Handle penetration properly */
-	start.setOrigin(m_currentPosition);
+	start.setOrigin(currentPosition());
 
-	m_targetPosition = m_currentPosition + m_up * (stepHeight)+m_jumpAxis * ((m_verticalOffset > 0.f ? m_verticalOffset : 0.f));
-	m_currentPosition = m_targetPosition;
+	targetPosition() = currentPosition() + m_up * (stepHeight)+m_jumpAxis * ((verticalOffset() > 0.f ? verticalOffset() : 0.f));
+	currentPosition() = targetPosition();
 
-	end.setOrigin(m_targetPosition);
+	end.setOrigin(targetPosition());
 
 	btKinematicClosestNotMeConvexResultCallback callback(m_ghostObject, -m_up, m_maxSlopeCosine);
 	callback.m_collisionFilterGroup = m_ghostObject->getBroadphaseHandle()->m_collisionFilterGroup;
@@ -220,55 +415,53 @@ void CharacterController::stepUp()
 
 	if(m_useGhostObjectSweepTest)
 	{
+		CC_STAT(++m_stats.sweeps_up);
 		m_ghostObject->convexSweepTest(m_convexShape, start, end, callback, world->getDispatchInfo().m_allowedCcdPenetration);
 	}
 	else
 	{
+		CC_STAT(++m_stats.sweeps_up);
 		world->convexSweepTest(m_convexShape, start, end, callback, world->getDispatchInfo().m_allowedCcdPenetration);
 	}
 
 	if(callback.hasHit() && m_ghostObject->hasContactResponse() && needsCollision(m_ghostObject, callback.m_hitCollisionObject))
 	{
+		if(!allowRecover)
+			return false;
+
 		// Only modify the position if the hit was a slope and not a wall or ceiling.
 		if(callback.m_hitNormalWorld.dot(m_up) > 0.0)
 		{
 			// we moved up only a fraction of the step height
-			m_currentStepOffset = stepHeight * callback.m_closestHitFraction;
+			stepOffset() = stepHeight * callback.m_closestHitFraction;
 			if(m_interpolateUp == true)
-				m_currentPosition.setInterpolate3(m_currentPosition, m_targetPosition, callback.m_closestHitFraction);
+				currentPosition().setInterpolate3(currentPosition(), targetPosition(), callback.m_closestHitFraction);
 			else
-				m_currentPosition = m_targetPosition;
+				currentPosition() = targetPosition();
 		}
 
 		btTransform& xform = m_ghostObject->getWorldTransform();
-		xform.setOrigin(m_currentPosition);
+		xform.setOrigin(currentPosition());
 		m_ghostObject->setWorldTransform(xform);
 
 		// fix penetration if we hit a ceiling for example
-		int numPenetrationLoops = 0;
-		m_touchingContact = false;
-		while(recoverFromPenetration())
-		{
-			numPenetrationLoops++;
-			m_touchingContact = true;
-			if(numPenetrationLoops > 4)
-				break;
-		}
-		m_targetPosition = m_ghostObject->getWorldTransform().getOrigin();
-		m_currentPosition = m_targetPosition;
+		m_touchingContact = resolvePenetration();
+		targetPosition() = m_ghostObject->getWorldTransform().getOrigin();
+		currentPosition() = targetPosition();
 
-		if(m_verticalOffset > 0)
+		if(verticalOffset() > 0)
 		{
-			m_verticalOffset = 0.0;
-			m_verticalVelocity = 0.0;
-			m_currentStepOffset = m_stepHeight;
+			verticalOffset() = 0.0;
+			verticalVelocity() = 0.0;
+			stepOffset() = m_stepHeight;
 		}
 	}
 	else
 	{
-		m_currentStepOffset = stepHeight;
-		m_currentPosition = m_targetPosition;
+		stepOffset() = stepHeight;
+		currentPosition() = targetPosition();
 	}
+	return true;
 }
 
 bool CharacterController::needsCollision(const btCollisionObject* body0, const btCollisionObject* body1)
@@ -280,7 +473,7 @@ bool CharacterController::needsCollision(const btCollisionObject* body0, const b
 
 void CharacterController::updateTargetPositionBasedOnCollision(const btVector3& hitNormal, btScalar tangentMag, btScalar normalMag)
 {
-	btVector3 movementDirection = m_targetPosition - m_currentPosition;
+	btVector3 movementDirection = targetPosition() - currentPosition();
 	btScalar movementLength = movementDirection.length();
 	if(movementLength > SIMD_EPSILON)
 	{
@@ -294,64 +487,63 @@ void CharacterController::updateTargetPositionBasedOnCollision(const btVector3&
 		parallelDir = parallelComponent(reflectDir, hitNormal);
 		perpindicularDir = perpindicularComponent(reflectDir, hitNormal);
 
-		m_targetPosition = m_currentPosition;
+		targetPosition() = currentPosition();
 
 		if(normalMag != 0.0)
 		{
 			btVector3 perpComponent = perpindicularDir * btScalar(normalMag * movementLength);
-			m_targetPosition += perpComponent;
+			targetPosition() += perpComponent;
 		}
 	}
 }
 
 void CharacterController::stepForwardAndStrafe(const btVector3& walkMove)
 {
+	CC_TIMER(time_forward);
 	// phase 2: forward and strafe
 	btTransform start, end;
 
-	m_targetPosition = m_currentPosition + walkMove;
+	targetPosition() = currentPosition() + walkMove;
 
 	start.setIdentity();
 	end.setIdentity();
 
 	btScalar fraction = 1.0;
-	btScalar distance2 = (m_currentPosition - m_targetPosition).length2();
+	btScalar distance2 = (currentPosition() - targetPosition()).length2();
 
 	int maxIter = 10;
 
 	while(fraction > btScalar(0.01) && maxIter-- > 0)
 	{
-		start.setOrigin(m_currentPosition);
-		end.setOrigin(m_targetPosition);
-		btVector3 sweepDirNegative(m_currentPosition - m_targetPosition);
+		CC_STAT(++m_stats.forward_iterations);
+		start.setOrigin(currentPosition());
+		end.setOrigin(targetPosition());
+		btVector3 sweepDirNegative(currentPosition() - targetPosition());
 
 		btKinematicClosestNotMeConvexResultCallback callback(m_ghostObject, sweepDirNegative, btScalar(0.0));
 		callback.m_collisionFilterGroup = m_ghostObject->getBroadphaseHandle()->m_collisionFilterGroup;
 		callback.m_collisionFilterMask = m_ghostObject->getBroadphaseHandle()->m_collisionFilterMask;
 
-		btScalar margin = m_convexShape->getMargin();
-		m_convexShape->setMargin(margin + m_addedMargin);
-
 		if(!(start == end))
 		{
 			if(m_useGhostObjectSweepTest)
 			{
+				CC_STAT(++m_stats.sweeps_forward);
 				m_ghostObject->convexSweepTest(m_convexShape, start, end, callback, world->getDispatchInfo().m_allowedCcdPenetration);
 			}
 			else
 			{
+				CC_STAT(++m_stats.sweeps_forward);
 				world->convexSweepTest(m_convexShape, start, end, callback, world->getDispatchInfo().m_allowedCcdPenetration);
 			}
 		}
-		m_convexShape->setMargin(margin);
-
 		fraction -= callback.m_closestHitFraction;
 
 		if(callback.hasHit() && m_ghostObject->hasContactResponse() && needsCollision(m_ghostObject, callback.m_hitCollisionObject))
 		{
 			// we moved only a fraction
 			updateTargetPositionBasedOnCollision(callback.m_hitNormalWorld);
-			btVector3 currentDir = m_targetPosition - m_currentPosition;
+			btVector3 currentDir = targetPosition() - currentPosition();
 			distance2 = currentDir.length2();
 			if(distance2 > SIMD_EPSILON)
 			{
@@ -365,30 +557,43 @@ void CharacterController::stepForwardAndStrafe(const btVector3& walkMove)
 		}
 		else
 		{
-			m_currentPosition = m_targetPosition;
+			currentPosition() = targetPosition();
 		}
 	}
 }
 
 void CharacterController::stepDown(btScalar dt)
 {
+	CC_TIMER(time_down);
 	btTransform start, end, end_double;
 	bool runonce = false;
 
 	// phase 3: down
 
-	btVector3 orig_position = m_targetPosition;
+	btVector3 orig_position = targetPosition();
 
-	btScalar downVelocity = (m_verticalVelocity < 0.f ? -m_verticalVelocity : 0.f) * dt;
+	btScalar downVelocity = (verticalVelocity() < 0.f ? -verticalVelocity() : 0.f) * dt;
 
-	if(m_verticalVelocity > 0.0)
+	if(verticalVelocity() > 0.0)
 		return;
 
-	if(downVelocity > 0.0 && downVelocity > m_fallSpeed && (m_wasOnGround || !m_wasJumping))
+	if(downVelocity > 0.0 && downVelocity > m_fallSpeed && (wasOnGround() || !isJumping()))
 		downVelocity = m_fallSpeed;
 
-	btVector3 step_drop = m_up * (m_currentStepOffset + downVelocity);
-	m_targetPosition -= step_drop;
+	// only terrain below, find ground analytically
+	if(m_ghostObject->hasContactResponse())
+	{
+		if(const Terrain* terrain = getTerrainBelow())
+		{
+			if(stepDownTerrain(*terrain, downVelocity, dt))
+				return;
+		}
+		if(m_groundMode == GROUND_RAYS && stepDownRays(downVelocity, dt))
+			return;
+	}
+
+	btVector3 step_drop = m_up * (stepOffset() + downVelocity);
+	targetPosition() -= step_drop;
 
 	btKinematicClosestNotMeConvexResultCallback callback(m_ghostObject, m_up, m_maxSlopeCosine);
 	callback.m_collisionFilterGroup = m_ghostObject->getBroadphaseHandle()->m_collisionFilterGroup;
@@ -405,50 +610,54 @@ void CharacterController::stepDown(btScalar dt)
 
 		end_double.setIdentity();
 
-		start.setOrigin(m_currentPosition);
-		end.setOrigin(m_targetPosition);
+		start.setOrigin(currentPosition());
+		end.setOrigin(targetPosition());
 
 		//set double test for 2x the step drop, to check for a large drop vs small drop
-		end_double.setOrigin(m_targetPosition - step_drop);
+		end_double.setOrigin(targetPosition() - step_drop);
 
 		if(m_useGhostObjectSweepTest)
 		{
+			CC_STAT(++m_stats.sweeps_down);
 			m_ghostObject->convexSweepTest(m_convexShape, start, end, callback, world->getDispatchInfo().m_allowedCcdPenetration);
 
 			if(!callback.hasHit() && m_ghostObject->hasContactResponse())
 			{
 				//test a double fall height, to see if the character should interpolate it's fall (full) or not (partial)
+				CC_STAT(++m_stats.sweeps_down);
 				m_ghostObject->convexSweepTest(m_convexShape, start, end_double, callback2, world->getDispatchInfo().m_allowedCcdPenetration);
 			}
 		}
 		else
 		{
+			CC_STAT(++m_stats.sweeps_down);
 			world->convexSweepTest(m_convexShape, start, end, callback, world->getDispatchInfo().m_allowedCcdPenetration);
 
 			if(!callback.hasHit() && m_ghostObject->hasContactResponse())
 			{
 				//test a double fall height, to see if the character should interpolate it's fall (large) or not (small)
+				CC_STAT(++m_stats.sweeps_down);
 				world->convexSweepTest(m_convexShape, start, end_double, callback2, world->getDispatchInfo().m_allowedCcdPenetration);
 			}
 		}
 
-		btScalar downVelocity2 = (m_verticalVelocity < 0.f ? -m_verticalVelocity : 0.f) * dt;
+		btScalar downVelocity2 = (verticalVelocity() < 0.f ? -verticalVelocity() : 0.f) * dt;
 		bool has_hit = callback2.hasHit() && m_ghostObject->hasContactResponse() && needsCollision(m_ghostObject, callback2.m_hitCollisionObject);
 
 		btScalar stepHeight = 0.0f;
-		if(m_verticalVelocity < 0.0)
+		if(verticalVelocity() < 0.0)
 			stepHeight = m_stepHeight;
 
-		if(downVelocity2 > 0.0 && downVelocity2 < stepHeight && has_hit == true && runonce == false && (m_wasOnGround || !m_wasJumping))
+		if(downVelocity2 > 0.0 && downVelocity2 < stepHeight && has_hit == true && runonce == false && (wasOnGround() || !isJumping()))
 		{
 			//redo the velocity calculation when falling a small amount, for fast stairs motion
 			//for larger falls, use the smoother/slower interpolated movement by not touching the target position
 
-			m_targetPosition = orig_position;
+			targetPosition() = orig_position;
 			downVelocity = stepHeight;
 
-			step_drop = m_up * (m_currentStepOffset + downVelocity);
-			m_targetPosition -= step_drop;
+			step_drop = m_up * (stepOffset() + downVelocity);
+			targetPosition() -= step_drop;
 			runonce = true;
 			continue;  //re-run previous tests
 		}
@@ -458,13 +667,13 @@ void CharacterController::stepDown(btScalar dt)
 	if((m_ghostObject->hasContactResponse() && (callback.hasHit() && needsCollision(m_ghostObject, callback.m_hitCollisionObject))) || runonce == true)
 	{
 		// we dropped a fraction of the height -> hit floor
-		//btScalar fraction = (m_currentPosition.getY() - callback.m_hitPointWorld.getY()) / 2;
+		//btScalar fraction = (currentPosition().getY() - callback.m_hitPointWorld.getY()) / 2;
 
-		m_currentPosition.setInterpolate3(m_currentPosition, m_targetPosition, callback.m_closestHitFraction);
+		currentPosition().setInterpolate3(currentPosition(), targetPosition(), callback.m_closestHitFraction);
 
-		m_verticalVelocity = 0.0;
-		m_verticalOffset = 0.0;
-		m_wasJumping = false;
+		verticalVelocity() = 0.0;
+		verticalOffset() = 0.0;
+		hotFlags() &= ~CharacterControllerSystem::F_JUMPING;
 	}
 	else
 	{
@@ -474,25 +683,144 @@ void CharacterController::stepDown(btScalar dt)
 			// TODO
 		}
 
-		m_currentPosition = m_targetPosition;
+		currentPosition() = targetPosition();
+	}
+}
+
+// Same as stepDown sweeps (including double drop test for stairs & downhill) but ground is terrain rest height of capsule
+// bottom sphere. Returns false when not applicable (not capsule, not y up, outside terrain, contact too steep to stand on).
+bool CharacterController::stepDownTerrain(const Terrain& terrain, btScalar downVelocity, btScalar dt)
+{
+	if(m_convexShape->getShapeType() != CAPSULE_SHAPE_PROXYTYPE || m_up != btVector3(0, 1, 0))
+		return false;
+	const btCapsuleShape* capsule = static_cast<const btCapsuleShape*>(m_convexShape);
+	btScalar restHeight;
+	btVector3 normal;
+	if(!terrain.GetSphereRestHeight(targetPosition().x(), targetPosition().z(), capsule->getRadius(), restHeight, normal)
+		|| normal.dot(m_up) < m_maxSlopeCosine)
+		return false;
+	stepDownToGround(restHeight + capsule->getHalfHeight(), downVelocity, dt);
+	return true;
+}
+
+// Ground height from ray casts straight down (center & ring of 4 at 3/4 radius) against objects in ghost pair cache.
+// Returns false when sweep is required: not capsule, not y up, some ray missed (ledge) or hit too steep surface.
+bool CharacterController::stepDownRays(btScalar downVelocity, btScalar dt)
+{
+	if(m_convexShape->getShapeType() != CAPSULE_SHAPE_PROXYTYPE || m_up != btVector3(0, 1, 0))
+		return false;
+	const btCapsuleShape* capsule = static_cast<const btCapsuleShape*>(m_convexShape);
+	const btScalar radius = capsule->getRadius();
+	const btScalar offset = radius * btScalar(0.75);
+	const btScalar sphereHeight = btSqrt(radius * radius - offset * offset); // bottom sphere surface below its center at ring
+	const btVector3 probes[5] = {
+		btVector3(0, 0, 0), btVector3(offset, 0, 0), btVector3(-offset, 0, 0), btVector3(0, 0, offset), btVector3(0, 0, -offset)
+	};
+
+	// deep enough for double drop test in stepDown
+	const btScalar stepHeight = (verticalVelocity() < 0.0 ? m_stepHeight : 0.f);
+	const btScalar drop = stepOffset() + btMax(downVelocity, stepHeight);
+	const btScalar fromY = currentPosition().y();
+	const btScalar toY = targetPosition().y() - capsule->getHalfHeight() - radius - drop * 2 - m_addedMargin;
+
+	btScalar groundHeight = -BT_LARGE_FLOAT;
+	for(int i = 0; i < 5; i++)
+	{
+		const btVector3 from(targetPosition().x() + probes[i].x(), fromY, targetPosition().z() + probes[i].z());
+		const btVector3 to(from.x(), toY, from.z());
+		btKinematicClosestNotMeRayResultCallback callback(m_ghostObject, from, to);
+		callback.m_collisionFilterGroup = m_ghostObject->getBroadphaseHandle()->m_collisionFilterGroup;
+		callback.m_collisionFilterMask = m_ghostObject->getBroadphaseHandle()->m_collisionFilterMask;
+		CC_STAT(++m_stats.rays_down);
+
+		btTransform rayFrom, rayTo;
+		rayFrom.setIdentity();
+		rayFrom.setOrigin(from);
+		rayTo.setIdentity();
+		rayTo.setOrigin(to);
+		for(int j = 0; j < m_ghostObject->getNumOverlappingObjects(); j++)
+		{
+			btCollisionObject* obj = m_ghostObject->getOverlappingObject(j);
+			if(!callback.needsCollision(obj->getBroadphaseHandle()))
+				continue;
+			btCollisionWorld::rayTestSingle(rayFrom, rayTo, obj, obj->getCollisionShape(), obj->getWorldTransform(), callback);
+		}
+
+		if(!callback.hasHit() || callback.m_hitNormalWorld.dot(m_up) < m_maxSlopeCosine)
+			return false;
+		const btScalar height = callback.m_hitPointWorld.y() + (i == 0 ? radius : sphereHeight) + capsule->getHalfHeight();
+		if(height > groundHeight)
+			groundHeight = height;
 	}
+
+	stepDownToGround(groundHeight, downVelocity, dt);
+	return true;
+}
+
+// Vertical part of stepDown when height of capsule center standing on ground is known, does same small drop snapping
+// as double sweep test.
+void CharacterController::stepDownToGround(btScalar groundHeight, btScalar downVelocity, btScalar dt)
+{
+	const btVector3 orig_position = targetPosition();
+	const btScalar drop = stepOffset() + downVelocity;
+	targetPosition() = orig_position - m_up * drop;
+	bool hit = targetPosition().y() <= groundHeight;
+	if(!hit)
+	{
+		// falling a small amount, snap to ground within double drop like stepDown
+		const btScalar downVelocity2 = (verticalVelocity() < 0.f ? -verticalVelocity() : 0.f) * dt;
+		const btScalar stepHeight = (verticalVelocity() < 0.0 ? m_stepHeight : 0.f);
+		if(downVelocity2 > 0.0 && downVelocity2 < stepHeight && orig_position.y() - drop * 2 <= groundHeight && (wasOnGround() || !isJumping()))
+		{
+			targetPosition() = orig_position - m_up * (stepOffset() + stepHeight);
+			hit = true;
+		}
+	}
+
+	if(hit)
+	{
+		const btScalar dist = currentPosition().y() - targetPosition().y();
+		const btScalar fraction = dist > SIMD_EPSILON ? btMax(btScalar(0), btMin(btScalar(1), (currentPosition().y() - groundHeight) / dist)) : btScalar(1);
+		currentPosition().setInterpolate3(currentPosition(), targetPosition(), fraction);
+		verticalVelocity() = 0.0;
+		verticalOffset() = 0.0;
+		hotFlags() &= ~CharacterControllerSystem::F_JUMPING;
+	}
+	else
+		currentPosition() = targetPosition();
+}
+
+// terrain if it's the only object near controller
+const Terrain* CharacterController::getTerrainBelow() const
+{
+	const Terrain* terrain = nullptr;
+	for(int i = 0; i < m_ghostObject->getNumOverlappingObjects(); i++)
+	{
+		const btCollisionObject* obj = m_ghostObject->getOverlappingObject(i);
+		if(terrain || obj->getCollisionShape()->getShapeType() != TERRAIN_SHAPE_PROXYTYPE)
+			return nullptr;
+		terrain = static_cast<const Terrain*>(obj->getUserPointer());
+	}
+	return terrain;
 }
 
 void CharacterController::setWalkDirection(const btVector3& walkDirection)
 {
-	m_walkDirection = walkDirection;
-	m_normalizedDirection = getNormalizedVector(m_walkDirection);
+	system->walk_directions[index] = walkDirection;
+	if(!walkDirection.fuzzyZero())
+		wakeUp();
 }
 
+// zero velocities count as standing on ground, same as before first update
 void CharacterController::reset()
 {
-	m_verticalVelocity = 0.0;
-	m_verticalOffset = 0.0;
-	m_wasOnGround = false;
-	m_wasJumping = false;
-	m_walkDirection.setValue(0, 0, 0);
+	verticalOffset() = 0.0;
 	m_velocityTimeInterval = 0.0;
-	m_horizontalVelocity.setValue(0, 0, 0);
+	horizontalVelocity().setValue(0, 0, 0);
+	system->walk_directions[index].setValue(0, 0, 0);
+	system->vertical_velocities[index] = 0.0;
+	system->flags[index] = CharacterControllerSystem::F_ON_GROUND;
+	idleTicks() = 0;
 
 	//clear pair cache
 	btHashedOverlappingPairCache* cache = m_ghostObject->getOverlappingPairCache();
@@ -508,50 +836,182 @@ void CharacterController::warp(const btVector3& origin)
 	xform.setIdentity();
 	xform.setOrigin(origin);
 	m_ghostObject->setWorldTransform(xform);
+	system->positions[index] = origin;
+	wakeUp();
+}
+
+void CharacterController::saveSnapshot(Snapshot& s) const
+{
+	s.transform = m_ghostObject->getWorldTransform();
+	s.walk_direction = system->walk_directions[index];
+	s.horizontal_velocity = system->horizontal_velocities[index];
+	s.jump_axis = m_jumpAxis;
+	s.jump_position = m_jumpPosition;
+	s.vertical_velocity = system->vertical_velocities[index];
+	s.vertical_offset = system->vertical_offsets[index];
+	s.jump_speed = m_jumpSpeed;
+	s.linear_damping = m_linearDamping;
+	s.step_offset = system->step_offsets[index];
+	s.residual_penetration = m_residualPenetration;
+	s.idle_ticks = system->idle_ticks[index];
+	s.flags = system->flags[index];
+	s.touching_contact = m_touchingContact;
+	s.prevent_fall = prevent_fall;
+}
+
+void CharacterController::loadSnapshot(const Snapshot& s)
+{
+	m_ghostObject->setWorldTransform(s.transform);
+	updateAabb(); // can wake this controller through ghost pair callback, so flags are set after it
+	targetPosition() = s.transform.getOrigin();
+	horizontalVelocity() = s.horizontal_velocity;
+	m_jumpAxis = s.jump_axis;
+	m_jumpPosition = s.jump_position;
+	verticalOffset() = s.vertical_offset;
+	m_jumpSpeed = s.jump_speed;
+	m_linearDamping = s.linear_damping;
+	stepOffset() = s.step_offset;
+	m_residualPenetration = s.residual_penetration;
+	idleTicks() = s.idle_ticks;
+	m_touchingContact = s.touching_contact;
+	prevent_fall = s.prevent_fall;
+	system->positions[index] = targetPosition();
+	system->walk_directions[index] = s.walk_direction;
+	system->vertical_velocities[index] = s.vertical_velocity;
+	system->flags[index] = s.flags;
 }
 
 void CharacterController::update(btScalar dt)
 {
-	m_currentPosition = m_ghostObject->getWorldTransform().getOrigin();
-	m_targetPosition = m_currentPosition;
-	m_wasOnGround = onGround();
+	TRACE_ZONE("CharacterController::update");
+	updateMove(dt, true);
+	updateEnd();
+}
+
+// Integrates velocity and does stepUp, stepForwardAndStrafe & stepDown sweeps. Only reads collision world when allowRecover
+// is false, then returns false (with state unchanged) if penetration recovery was required and whole update must be redone.
+bool CharacterController::updateMove(btScalar dt, bool allowRecover)
+{
+	TRACE_ZONE("CharacterController::updateMove");
+	CC_STAT(m_stats = Stats());
+
+	// hot state is used in place, position in system equals ghost position between updates
+	m_normalizedDirection = getNormalizedVector(walkDirection());
+	targetPosition() = currentPosition();
 
 	// damping & apply horizontal velocity
-	m_horizontalVelocity = m_horizontalVelocity * (1.f - dt * m_linearDamping) + m_walkDirection * (dt * m_linearDamping);
+	const btVector3 prevHorizontalVelocity = horizontalVelocity();
+	const btScalar prevVerticalVelocity = verticalVelocity();
+	horizontalVelocity() = horizontalVelocity() * (1.f - dt * m_linearDamping) + walkDirection() * (dt * m_linearDamping);
 
 	// Update fall velocity.
-	m_verticalVelocity -= m_gravity * dt;
-	if(m_verticalVelocity > 0.0 && m_verticalVelocity > m_jumpSpeed)
+	verticalVelocity() -= m_gravity * dt;
+	if(verticalVelocity() > 0.0 && verticalVelocity() > m_jumpSpeed)
 	{
-		m_verticalVelocity = m_jumpSpeed;
+		verticalVelocity() = m_jumpSpeed;
 	}
-	if(m_verticalVelocity < 0.0 && btFabs(m_verticalVelocity) > btFabs(m_fallSpeed))
+	if(verticalVelocity() < 0.0 && btFabs(verticalVelocity()) > btFabs(m_fallSpeed))
 	{
-		m_verticalVelocity = -btFabs(m_fallSpeed);
+		verticalVelocity() = -btFabs(m_fallSpeed);
 	}
-	m_verticalOffset = m_verticalVelocity * dt;
+	verticalOffset() = verticalVelocity() * dt;
 
 	btTransform xform;
 	xform = m_ghostObject->getWorldTransform();
 
-	stepUp();
+	if(!stepUp(allowRecover))
+	{
+		horizontalVelocity() = prevHorizontalVelocity;
+		verticalVelocity() = prevVerticalVelocity;
+		currentPosition() = xform.getOrigin();
+		return false;
+	}
 
-	stepForwardAndStrafe(m_horizontalVelocity * dt);
+	stepForwardAndStrafe(horizontalVelocity() * dt);
 
 	stepDown(dt);
 
-	xform.setOrigin(m_currentPosition);
+	xform.setOrigin(currentPosition());
 	m_ghostObject->setWorldTransform(xform);
+	return true;
+}
 
-	int numPenetrationLoops = 0;
-	m_touchingContact = false;
-	while(recoverFromPenetration())
+// Recovers from penetration (updates broadphase & dispatches narrowphase) and stores hot state.
+void CharacterController::updateEnd()
+{
 	{
-		numPenetrationLoops++;
-		m_touchingContact = true;
-		if(numPenetrationLoops > 4)
-			break;
+		CC_TIMER(time_penetration);
+		m_touchingContact = resolvePenetration();
+	}
+	CC_STAT(m_totalStats.Add(m_stats));
+
+	// F_ON_GROUND was last update state until now, F_JUMPING is already cleared by landing
+	byte& flags = hotFlags();
+	flags &= CharacterControllerSystem::F_JUMPING;
+	if((fabs(verticalVelocity()) < SIMD_EPSILON) && (fabs(verticalOffset()) < SIMD_EPSILON))
+		flags |= CharacterControllerSystem::F_ON_GROUND;
+
+	// go to sleep after resting for few updates, woken by input, jump, warp or overlap change
+	if(IsSet(flags, CharacterControllerSystem::F_ON_GROUND) && !m_touchingContact && walkDirection().fuzzyZero()
+		&& horizontalVelocity().length2() < btScalar(0.0001) && !hasMovingNeighbor())
+	{
+		if(++idleTicks() >= SLEEP_TICKS)
+		{
+			horizontalVelocity().setValue(0, 0, 0);
+			flags |= CharacterControllerSystem::F_SLEEPING;
+		}
+	}
+	else
+		idleTicks() = 0;
+}
+
+// bounds of possible movement in next update, used to find controllers that can't interact
+void CharacterController::getMotionAabb(btScalar dt, btVector3& aabbMin, btVector3& aabbMax) const
+{
+	const btScalar horizontal = btMax(system->horizontal_velocities[index].length(), system->walk_directions[index].length()) * dt;
+	const btScalar vertical = btMax(btFabs(system->vertical_velocities[index]) + m_gravity * dt, m_jumpSpeed) * dt;
+	const btScalar reach = horizontal + vertical + m_stepHeight * 2 + m_addedMargin + btScalar(0.2);
+	m_convexShape->getAabb(m_ghostObject->getWorldTransform(), aabbMin, aabbMax);
+	aabbMin -= btVector3(reach, reach, reach);
+	aabbMax += btVector3(reach, reach, reach);
+}
+
+// any other controller in ghost pair cache
+bool CharacterController::hasControllerNeighbor() const
+{
+	for(int i = 0; i < m_ghostObject->getNumOverlappingObjects(); i++)
+	{
+		const btCollisionObject* obj = m_ghostObject->getOverlappingObject(i);
+		if(btGhostObject::upcast(obj) && obj->getUserPointer())
+			return true;
+	}
+	return false;
+}
+
+// other non static object in ghost aabb that is not resting too
+bool CharacterController::hasMovingNeighbor() const
+{
+	for(int i = 0; i < m_ghostObject->getNumOverlappingObjects(); i++)
+	{
+		const btCollisionObject* obj = m_ghostObject->getOverlappingObject(i);
+		if(obj->isStaticObject())
+			continue;
+		const CharacterController* other = btGhostObject::upcast(obj) ? static_cast<const CharacterController*>(obj->getUserPointer()) : nullptr;
+		if(!other || (!IsSet(system->flags[other->index], CharacterControllerSystem::F_SLEEPING) && system->idle_ticks[other->index] == 0))
+			return true;
 	}
+	return false;
+}
+
+bool CharacterController::isSleeping() const
+{
+	return IsSet(system->flags[index], CharacterControllerSystem::F_SLEEPING);
+}
+
+void CharacterController::wakeUp()
+{
+	system->flags[index] &= ~CharacterControllerSystem::F_SLEEPING;
+	idleTicks() = 0;
 }
 
 void CharacterController::setFallSpeed(btScalar fallSpeed)
@@ -573,8 +1033,9 @@ bool CharacterController::canJump() const
 void CharacterController::jump()
 {
 	m_jumpSpeed = m_SetjumpSpeed;
-	m_verticalVelocity = m_jumpSpeed;
-	m_wasJumping = true;
+	system->vertical_velocities[index] = m_jumpSpeed;
+	system->flags[index] = CharacterControllerSystem::F_JUMPING;
+	idleTicks() = 0;
 
 	m_jumpAxis = m_up;
 
@@ -604,9 +1065,64 @@ btScalar CharacterController::getMaxSlope() const
 	return m_maxSlopeRadians;
 }
 
+#if CC_COUNTERS
+template<typename T>
+static void SetMax(T& value, T other)
+{
+	if(other > value)
+		value = other;
+}
+
+void CharacterController::Stats::Add(const Stats& s)
+{
+	sweeps_up += s.sweeps_up;
+	sweeps_forward += s.sweeps_forward;
+	sweeps_down += s.sweeps_down;
+	rays_down += s.rays_down;
+	forward_iterations += s.forward_iterations;
+	penetration_loops += s.penetration_loops;
+	dispatches += s.dispatches;
+	time_up += s.time_up;
+	time_forward += s.time_forward;
+	time_down += s.time_down;
+	time_penetration += s.time_penetration;
+}
+
+void CharacterController::Stats::Max(const Stats& s)
+{
+	SetMax(sweeps_up, s.sweeps_up);
+	SetMax(sweeps_forward, s.sweeps_forward);
+	SetMax(sweeps_down, s.sweeps_down);
+	SetMax(rays_down, s.rays_down);
+	SetMax(forward_iterations, s.forward_iterations);
+	SetMax(penetration_loops, s.penetration_loops);
+	SetMax(dispatches, s.dispatches);
+	SetMax(time_up, s.time_up);
+	SetMax(time_forward, s.time_forward);
+	SetMax(time_down, s.time_down);
+	SetMax(time_penetration, s.time_penetration);
+}
+
+void CharacterController::resetStats()
+{
+	m_stats = Stats();
+	m_totalStats = Stats();
+}
+#endif
+
 bool CharacterController::onGround() const
 {
-	return (fabs(m_verticalVelocity) < SIMD_EPSILON) && (fabs(m_verticalOffset) < SIMD_EPSILON);
+	return IsSet(system->flags[index], CharacterControllerSystem::F_ON_GROUND);
+}
+
+const btVector3& CharacterController::getPos() const
+{
+	return system->positions[index];
+}
+
+const btVector3& CharacterController::getVelocity() const
+{
+	return system->horizontal_velocities[index];
 }
 
 void CharacterController::setStepHeight(btScalar h)
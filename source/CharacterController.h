@@ -2,21 +2,75 @@
 
 #include <btBulletCollisionCommon.h>
 
+// per update timings, compiled out in release unless CC_PROFILE is defined
+#ifndef CC_PROFILE
+#	ifdef _DEBUG
+#		define CC_PROFILE 1
+#	else
+#		define CC_PROFILE 0
+#	endif
+#endif
+// per update integer counters, compiled out in release unless CC_BENCH_COUNTERS is defined
+// (msbuild /p:BenchCounters=true builds release for -bench with them)
+#ifndef CC_BENCH_COUNTERS
+#	ifdef _DEBUG
+#		define CC_BENCH_COUNTERS 1
+#	else
+#		define CC_BENCH_COUNTERS 0
+#	endif
+#endif
+#define CC_COUNTERS (CC_PROFILE || CC_BENCH_COUNTERS)
+
 class btPairCachingGhostObject;
-class btGhostPairCallback;
 
 // based on btKinematicCharacterController.h
 ATTRIBUTE_ALIGNED16(struct) CharacterController
 {
+	friend class CharacterControllerSystem;
+
+#if CC_COUNTERS
+	struct Stats
+	{
+		uint sweeps_up, sweeps_forward, sweeps_down;
+		uint rays_down; // GROUND_RAYS probes
+		uint forward_iterations; // stepForwardAndStrafe maxIter loop
+		uint penetration_loops; // resolvePenetration passes that found penetration
+		uint dispatches; // dispatchAllCollisionPairs calls
+		float time_up, time_forward, time_down, time_penetration; // in seconds, only measured with CC_PROFILE
+
+		Stats() { memset(this, 0, sizeof(Stats)); }
+		uint GetSweeps() const { return sweeps_up + sweeps_forward + sweeps_down; }
+		float GetTime() const { return time_up + time_forward + time_down + time_penetration; }
+		void Add(const Stats& s);
+		void Max(const Stats& s);
+	};
+#endif
+
+	// complete simulation state, plain data so it can be copied into preallocated buffers (rollback & resimulation)
+	struct Snapshot
+	{
+		btTransform transform;
+		btVector3 walk_direction, horizontal_velocity, jump_axis, jump_position;
+		btScalar vertical_velocity, vertical_offset, jump_speed, linear_damping, step_offset, residual_penetration;
+		int idle_ticks;
+		byte flags; // CharacterControllerSystem::Flags
+		bool touching_contact, prevent_fall;
+	};
+
+	enum GroundMode
+	{
+		GROUND_SWEEP, // convex sweeps, precise
+		GROUND_RAYS // few ray casts, falls back to sweeps at ledges & steep slopes
+	};
+
 protected:
+	CharacterControllerSystem* system;
+	uint index;
 	btCollisionWorld* world;
 	btPairCachingGhostObject* m_ghostObject;
-	btGhostPairCallback* ghost_callback;
 	btConvexShape* m_convexShape;  //is also in m_ghostObject, but it needs to be convex, so we store it here to avoid upcast
 
 	btScalar m_maxPenetrationDepth;
-	btScalar m_verticalVelocity;
-	btScalar m_verticalOffset;
 	btScalar m_fallSpeed;
 	btScalar m_jumpSpeed;
 	btScalar m_SetjumpSpeed;
@@ -28,28 +82,28 @@ protected:
 
 	btScalar m_addedMargin;  //@todo: remove this and fix the code
 
-	///this is the desired walk direction, set by the user
-	btVector3 m_walkDirection;
-	btVector3 m_normalizedDirection;
-	btVector3 m_horizontalVelocity;
+	btVector3 m_normalizedDirection; // of walk direction, set on update
 
+	// set only by jump, not per tick
 	btVector3 m_jumpPosition;
 
-	//some internal variables
-	btVector3 m_currentPosition;
-	btScalar m_currentStepOffset;
-	btVector3 m_targetPosition;
-
 	///keep track of the contact manifolds
 	btManifoldArray m_manifoldArray;
+	struct Penetration
+	{
+		btVector3 normal;
+		btScalar depth;
+	};
+	btAlignedObjectArray<Penetration> m_contacts; // raw penetrating contacts, sorted before merge
+	btAlignedObjectArray<btVector3> m_penetrationNormals; // gathered by gatherPenetrations
+	btAlignedObjectArray<btScalar> m_penetrationDepths;
+	btScalar m_residualPenetration;
 
 	bool m_touchingContact;
 	btVector3 m_touchingNormal;
 
 	btScalar m_linearDamping;
 
-	bool m_wasOnGround;
-	bool m_wasJumping;
 	bool m_useGhostObjectSweepTest;
 	btScalar m_velocityTimeInterval;
 	btVector3 m_up;
@@ -57,14 +111,47 @@ protected:
 
 	bool m_interpolateUp;
 	bool prevent_fall;
-
-	bool recoverFromPenetration();
-	void stepUp();
+	GroundMode m_groundMode;
+
+	static const int SLEEP_TICKS = 10;
+
+#if CC_COUNTERS
+	Stats m_stats; // last update
+	Stats m_totalStats; // accumulated until resetStats
+#endif
+
+	// per tick state is stored only in system arrays (indexed by index), step functions read & write it there
+	btVector3& currentPosition();
+	btVector3& targetPosition();
+	btVector3& horizontalVelocity();
+	btScalar& verticalVelocity();
+	btScalar& verticalOffset();
+	btScalar& stepOffset();
+	int& idleTicks();
+	const btVector3& walkDirection() const;
+	byte& hotFlags();
+	bool wasOnGround() const; // F_ON_GROUND is updated at end of update
+	bool isJumping() const;
+
+	void updateAabb();
+	bool gatherPenetrations();
+	btVector3 solvePenetration(btScalar& residual) const;
+	bool resolvePenetration();
+	bool stepUp(bool allowRecover);
 	void updateTargetPositionBasedOnCollision(const btVector3 & hit_normal, btScalar tangentMag = btScalar(0.0), btScalar normalMag = btScalar(1.0));
 	void stepForwardAndStrafe(const btVector3 & walkMove);
 	void stepDown(btScalar dt);
+	bool stepDownTerrain(const Terrain& terrain, btScalar downVelocity, btScalar dt);
+	bool stepDownRays(btScalar downVelocity, btScalar dt);
+	void stepDownToGround(btScalar groundHeight, btScalar downVelocity, btScalar dt);
+	const Terrain* getTerrainBelow() const;
 
 	bool needsCollision(const btCollisionObject * body0, const btCollisionObject * body1);
+	bool hasMovingNeighbor() const;
+	bool hasControllerNeighbor() const;
+	void getMotionAabb(btScalar dt, btVector3& aabbMin, btVector3& aabbMax) const;
+	bool updateMove(btScalar dt, bool allowRecover);
+	void updateEnd();
 
 	void setUpVector(const btVector3 & up);
 
@@ -73,7 +160,7 @@ protected:
 public:
 	BT_DECLARE_ALIGNED_ALLOCATOR();
 
-	CharacterController(float radius, float height);
+	CharacterController(CharacterControllerSystem* system, uint index, btConvexShape* shape, float height);
 	~CharacterController();
 
 	void update(btScalar deltaTime);
@@ -91,11 +178,16 @@ public:
 
 	void setLinearDamping(btScalar d) { m_linearDamping = d; }
 	btScalar getLinearDamping() const { return m_linearDamping; }
-	const btVector3& getVelocity() const { return m_horizontalVelocity; }
+	const btVector3& getVelocity() const;
 
 	void reset();
 	void warp(const btVector3 & origin);
 
+	void saveSnapshot(Snapshot& s) const;
+	/// Restored controller simulates same as from saved state. Broadphase is moved at once, pairs left from current
+	/// position are removed by next CharacterControllerSystem::Update. Neighbors with changed overlaps are woken.
+	void loadSnapshot(const Snapshot& s);
+
 	void setStepHeight(btScalar h);
 	btScalar getStepHeight() const { return m_stepHeight; }
 	void setFallSpeed(btScalar fallSpeed);
@@ -119,6 +211,20 @@ public:
 	bool onGround() const;
 	void setUpInterpolate(bool value);
 
+	/// Resting controllers are skipped by CharacterControllerSystem::Update until woken.
+	bool isSleeping() const;
+	void wakeUp();
+
 	void setPreventFall(bool value) { prevent_fall = value; }
-	const btVector3& getPos() const { return m_currentPosition; }
+	void setGroundMode(GroundMode mode) { m_groundMode = mode; }
+	GroundMode getGroundMode() const { return m_groundMode; }
+	const btVector3& getPos() const;
+	uint getIndex() const { return index; }
+	/// Penetration depth left after last update (over allowed max penetration depth).
+	btScalar getResidualPenetration() const { return m_residualPenetration; }
+#if CC_COUNTERS
+	const Stats& getStats() const { return m_stats; }
+	const Stats& getTotalStats() const { return m_totalStats; }
+	void resetStats();
+#endif
 };
@@ -0,0 +1,199 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "CharacterControllerSystem.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <BulletCollision\CollisionDispatch\btGhostObject.h>
+#include <LinearMath\btAabbUtil2.h>
+
+// wakes sleeping controllers when something starts or stops overlapping them
+class WakeGhostPairCallback : public btGhostPairCallback
+{
+public:
+	btBroadphasePair* addOverlappingPair(btBroadphaseProxy* proxy0, btBroadphaseProxy* proxy1) override
+	{
+		Wake(proxy0);
+		Wake(proxy1);
+		return btGhostPairCallback::addOverlappingPair(proxy0, proxy1);
+	}
+
+	void* removeOverlappingPair(btBroadphaseProxy* proxy0, btBroadphaseProxy* proxy1, btDispatcher* dispatcher) override
+	{
+		Wake(proxy0);
+		Wake(proxy1);
+		return btGhostPairCallback::removeOverlappingPair(proxy0, proxy1, dispatcher);
+	}
+
+private:
+	void Wake(btBroadphaseProxy* proxy)
+	{
+		btCollisionObject* obj = static_cast<btCollisionObject*>(proxy->m_clientObject);
+		if(btGhostObject::upcast(obj) && obj->getUserPointer())
+			static_cast<CharacterController*>(obj->getUserPointer())->wakeUp();
+	}
+};
+
+CharacterControllerSystem::CharacterControllerSystem(btCollisionWorld* world) : world(world), pool(nullptr), awake_count(0)
+{
+	ghost_callback = new WakeGhostPairCallback;
+	world->getPairCache()->setInternalGhostPairCallback(ghost_callback);
+}
+
+CharacterControllerSystem::~CharacterControllerSystem()
+{
+	for(CharacterController* controller : controllers)
+		delete controller;
+	world->getPairCache()->setInternalGhostPairCallback(nullptr);
+	delete ghost_callback;
+	for(Shape& shape : shapes)
+		delete shape.shape;
+}
+
+CharacterController* CharacterControllerSystem::Add(float radius, float height)
+{
+	const uint index = (uint)controllers.size();
+	btVector3 pos(0, height / 2, 0);
+	positions.push_back(pos);
+	walk_directions.push_back(btVector3(0, 0, 0));
+	target_positions.push_back(pos);
+	horizontal_velocities.push_back(btVector3(0, 0, 0));
+	vertical_velocities.push_back(0.f);
+	vertical_offsets.push_back(0.f);
+	step_offsets.push_back(0.f);
+	idle_ticks.push_back(0);
+	flags.push_back(F_ON_GROUND); // zero velocities count as standing on ground
+
+	CharacterController* controller = new CharacterController(this, index, GetShape(radius, height), height);
+	controllers.push_back(controller);
+	return controller;
+}
+
+void CharacterControllerSystem::Remove(CharacterController* controller)
+{
+	// delete first, removing ghost from world can wake neighbors by index
+	const uint index = controller->index;
+	const uint last = (uint)controllers.size() - 1;
+	delete controller;
+
+	// swap with last to keep arrays packed
+	if(index != last)
+	{
+		controllers[index] = controllers[last];
+		controllers[index]->index = index;
+		positions[index] = positions[last];
+		walk_directions[index] = walk_directions[last];
+		target_positions[index] = target_positions[last];
+		horizontal_velocities[index] = horizontal_velocities[last];
+		vertical_velocities[index] = vertical_velocities[last];
+		vertical_offsets[index] = vertical_offsets[last];
+		step_offsets[index] = step_offsets[last];
+		idle_ticks[index] = idle_ticks[last];
+		flags[index] = flags[last];
+	}
+	controllers.pop_back();
+	positions.pop_back();
+	walk_directions.pop_back();
+	target_positions.pop_back();
+	horizontal_velocities.pop_back();
+	vertical_velocities.pop_back();
+	vertical_offsets.pop_back();
+	step_offsets.pop_back();
+	idle_ticks.pop_back();
+	flags.pop_back();
+}
+
+void CharacterControllerSystem::Update(float dt)
+{
+	TRACE_ZONE("CharacterControllerSystem::Update");
+#if CC_COUNTERS
+	frame_stats = CharacterController::Stats();
+#endif
+	const uint count = (uint)controllers.size();
+	awake_count = 0;
+
+	// remove stale overlapping pairs left by last update, so ghost pair caches only contain real neighbors
+	world->getBroadphase()->calculateOverlappingPairs(world->getDispatcher());
+
+	moved.assign(count, 0);
+	if(pool && pool->GetThreadCount() > 1 && count > 1)
+	{
+		FindIsolated(dt);
+		pool->ParallelFor((uint)jobs.size(), [this, dt](uint job)
+		{
+			const uint index = jobs[job];
+			moved[index] = controllers[index]->updateMove(dt, false) ? 1 : 0;
+		});
+	}
+
+	for(uint i = 0; i < count; ++i)
+	{
+		if(IsSet(flags[i], F_SLEEPING))
+			continue;
+		++awake_count;
+		if(moved[i])
+			controllers[i]->updateEnd();
+		else
+			controllers[i]->update(dt);
+#if CC_COUNTERS
+		frame_stats.Add(controllers[i]->getStats());
+#endif
+	}
+}
+
+// Marks awake controllers whose reachable bounds don't overlap any other controller (sort & sweep on x axis),
+// they only sweep against static level so can move in parallel before serial broadphase updates.
+void CharacterControllerSystem::FindIsolated(float dt)
+{
+	const uint count = (uint)controllers.size();
+	aabb_min.resize(count);
+	aabb_max.resize(count);
+	order.resize(count);
+	isolated.assign(count, 1);
+	for(uint i = 0; i < count; ++i)
+	{
+		controllers[i]->getMotionAabb(dt, aabb_min[i], aabb_max[i]);
+		order[i] = i;
+		if(controllers[i]->hasControllerNeighbor())
+			isolated[i] = 0;
+	}
+
+	std::sort(order.begin(), order.end(), [this](uint a, uint b) { return aabb_min[a].x() < aabb_min[b].x(); });
+	for(uint i = 0; i < count; ++i)
+	{
+		const uint a = order[i];
+		for(uint j = i + 1; j < count; ++j)
+		{
+			const uint b = order[j];
+			if(aabb_min[b].x() > aabb_max[a].x())
+				break;
+			if(TestAabbAgainstAabb2(aabb_min[a], aabb_max[a], aabb_min[b], aabb_max[b]))
+			{
+				isolated[a] = 0;
+				isolated[b] = 0;
+			}
+		}
+	}
+
+	jobs.clear();
+	for(uint i = 0; i < count; ++i)
+	{
+		if(isolated[i] && !IsSet(flags[i], F_SLEEPING))
+			jobs.push_back(i);
+	}
+}
+
+btConvexShape* CharacterControllerSystem::GetShape(float radius, float height)
+{
+	for(Shape& shape : shapes)
+	{
+		if(shape.radius == radius && shape.height == height)
+			return shape.shape;
+	}
+
+	Shape shape;
+	shape.radius = radius;
+	shape.height = height;
+	shape.shape = new btCapsuleShape(radius, height - radius * 2);
+	shapes.push_back(shape);
+	return shape.shape;
+}
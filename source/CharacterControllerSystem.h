@@ -0,0 +1,61 @@
+#pragma once
+
+#include "CharacterController.h"
+
+class btGhostPairCallback;
+
+// Owns all character controllers in collision world. Have single ghost pair callback, shares capsule shapes
+// and keeps per tick state in structure of arrays (indexed by CharacterController::index), controllers
+// update it in place. Controller objects keep only settings, ghost object, jump state, stats & scratch buffers.
+// Sleeping controllers are skipped in Update, ghost pair callback wakes them when broadphase overlaps change.
+// With thread pool set, sweeps of controllers that can't reach any other controller in this update are done in
+// parallel, broadphase & narrowphase updates stay serial in index order so result is same as single threaded.
+class CharacterControllerSystem
+{
+public:
+	enum Flags
+	{
+		F_ON_GROUND = 1 << 0,
+		F_JUMPING = 1 << 1,
+		F_SLEEPING = 1 << 2
+	};
+
+	explicit CharacterControllerSystem(btCollisionWorld* world);
+	~CharacterControllerSystem();
+	CharacterController* Add(float radius, float height);
+	void Remove(CharacterController* controller);
+	void Update(float dt);
+	void SetThreadPool(ThreadPool* pool) { this->pool = pool; }
+	btConvexShape* GetShape(float radius, float height);
+	btCollisionWorld* GetWorld() { return world; }
+	uint GetCount() const { return (uint)controllers.size(); }
+	uint GetAwakeCount() const { return awake_count; }
+	CharacterController* Get(uint index) { return controllers[index]; }
+
+	btAlignedObjectArray<btVector3> positions, walk_directions, target_positions, horizontal_velocities;
+	vector<btScalar> vertical_velocities, vertical_offsets, step_offsets;
+	vector<int> idle_ticks;
+	vector<byte> flags;
+#if CC_COUNTERS
+	CharacterController::Stats frame_stats; // sum of all controllers in last Update
+#endif
+
+private:
+	struct Shape
+	{
+		float radius, height;
+		btCapsuleShape* shape;
+	};
+
+	btCollisionWorld* world;
+	void FindIsolated(float dt);
+
+	btGhostPairCallback* ghost_callback;
+	ThreadPool* pool;
+	uint awake_count;
+	vector<Shape> shapes;
+	vector<CharacterController*> controllers;
+	vector<byte> isolated, moved; // moved is 1 if updateMove was done in parallel pass
+	vector<uint> order, jobs;
+	btAlignedObjectArray<btVector3> aabb_min, aabb_max;
+};
@@ -0,0 +1,73 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "CmdLine.h"
+
+CmdLine::CmdLine(cstring cmd_line)
+{
+	if(!cmd_line)
+		return;
+	cstring s = cmd_line;
+	while(*s)
+	{
+		while(*s == ' ' || *s == '\t')
+			++s;
+		if(!*s)
+			break;
+		cstring start;
+		if(*s == '"')
+		{
+			start = ++s;
+			while(*s && *s != '"')
+				++s;
+			args.push_back(string(start, s));
+			if(*s)
+				++s;
+		}
+		else
+		{
+			start = s;
+			while(*s && *s != ' ' && *s != '\t')
+				++s;
+			args.push_back(string(start, s));
+		}
+	}
+}
+
+int CmdLine::Find(cstring name) const
+{
+	for(int i = 0, count = (int)args.size(); i < count; ++i)
+	{
+		const string& arg = args[i];
+		if(arg[0] == '-' && arg.compare(1, string::npos, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+bool CmdLine::Has(cstring name) const
+{
+	return Find(name) != -1;
+}
+
+cstring CmdLine::Get(cstring name, cstring def) const
+{
+	int index = Find(name);
+	if(index == -1 || index + 1 == (int)args.size())
+		return def;
+	const string& value = args[index + 1];
+	if(value[0] == '-' && !(value.length() > 1 && (isdigit(value[1]) || value[1] == '.')))
+		return def;
+	return value.c_str();
+}
+
+int CmdLine::GetInt(cstring name, int def) const
+{
+	cstring value = Get(name);
+	return value ? atoi(value) : def;
+}
+
+float CmdLine::GetFloat(cstring name, float def) const
+{
+	cstring value = Get(name);
+	return value ? (float)atof(value) : def;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+// Command line arguments in format: -name [value] -other_name ...
+class CmdLine
+{
+public:
+	explicit CmdLine(cstring cmd_line);
+	bool Has(cstring name) const;
+	cstring Get(cstring name, cstring def = nullptr) const;
+	int GetInt(cstring name, int def) const;
+	float GetFloat(cstring name, float def) const;
+
+private:
+	int Find(cstring name) const;
+
+	vector<string> args;
+};
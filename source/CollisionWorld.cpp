@@ -0,0 +1,19 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "CollisionWorld.h"
+
+CollisionWorld::CollisionWorld()
+{
+	config = new btDefaultCollisionConfiguration;
+	dispatcher = new btCollisionDispatcher(config);
+	broadphase = new btDbvtBroadphase;
+	world = new btCollisionWorld(dispatcher, broadphase, config);
+}
+
+CollisionWorld::~CollisionWorld()
+{
+	delete world;
+	delete broadphase;
+	delete dispatcher;
+	delete config;
+}
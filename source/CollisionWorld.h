@@ -0,0 +1,18 @@
+#pragma once
+
+#include <btBulletCollisionCommon.h>
+
+// Standalone collision world, used when running without engine physics
+class CollisionWorld
+{
+public:
+	CollisionWorld();
+	~CollisionWorld();
+	btCollisionWorld* Get() { return world; }
+
+private:
+	btDefaultCollisionConfiguration* config;
+	btCollisionDispatcher* dispatcher;
+	btBroadphaseInterface* broadphase;
+	btCollisionWorld* world;
+};
@@ -0,0 +1,119 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "FrameTimes.h"
+#include <algorithm>
+#include <fstream>
+
+FrameTimes::FrameTimes() : written(0), current(), started(false), drawn(false)
+{
+}
+
+void FrameTimes::BeginFrame()
+{
+	const Clock::time_point now = Clock::now();
+	if(started)
+	{
+		current.time[T_FRAME] = std::chrono::duration<float>(now - frame_start).count();
+		current.time[T_DRAW] = std::chrono::duration<float>(now - update_end).count();
+		current.time[T_WAIT] = drawn ? std::chrono::duration<float>(now - draw_end).count() : 0.f;
+		const uint index = written.load(std::memory_order_relaxed);
+		frames[index % SIZE] = current;
+		written.store(index + 1, std::memory_order_release);
+	}
+	started = true;
+	drawn = false;
+	frame_start = now;
+	current = Frame();
+}
+
+void FrameTimes::EndUpdate()
+{
+	update_end = Clock::now();
+	current.time[T_UPDATE] = std::chrono::duration<float>(update_end - frame_start).count();
+}
+
+void FrameTimes::EndDraw()
+{
+	draw_end = Clock::now();
+	drawn = true;
+}
+
+void FrameTimes::Copy(vector<Frame>& out, uint count) const
+{
+	const uint end = GetWritten();
+	count = Min(count, Min(end, SIZE));
+	out.resize(count);
+	for(uint i = 0; i < count; ++i)
+		out[i] = frames[(end - count + i) % SIZE];
+
+	// frames overwritten while copying are dropped (only when reader isn't on main thread)
+	const uint now = GetWritten();
+	if(now - end + count > SIZE)
+	{
+		const uint torn = Min(count, now - end + count - SIZE);
+		out.erase(out.begin(), out.begin() + torn);
+	}
+}
+
+// nearest rank percentiles
+FrameTimes::Summary FrameTimes::Summarize(const vector<Frame>& frames, Timing timing)
+{
+	Summary summary = {};
+	if(frames.empty())
+		return summary;
+	vector<float> values;
+	values.reserve(frames.size());
+	for(const Frame& frame : frames)
+		values.push_back(frame.time[timing]);
+	std::sort(values.begin(), values.end());
+	const uint count = (uint)values.size();
+	auto percentile = [&](uint p) { return values[Max(1u, (count * p + 99) / 100) - 1]; };
+	summary.p50 = percentile(50);
+	summary.p95 = percentile(95);
+	summary.p99 = percentile(99);
+	summary.max = values.back();
+	return summary;
+}
+
+bool FrameTimes::SaveCsv(cstring path) const
+{
+	vector<Frame> copy;
+	Copy(copy, SIZE);
+	std::ofstream f(path);
+	if(!f)
+		return false;
+	f << "frame";
+	for(uint i = 0; i < T_MAX; ++i)
+		f << ',' << GetName((Timing)i) << "_ms";
+	f << '\n';
+	const uint first = GetWritten() - (uint)copy.size();
+	for(uint i = 0; i < (uint)copy.size(); ++i)
+	{
+		f << first + i;
+		for(uint j = 0; j < T_MAX; ++j)
+			f << ',' << copy[i].time[j] * 1000.f;
+		f << '\n';
+	}
+	return (bool)f;
+}
+
+cstring FrameTimes::GetName(Timing timing)
+{
+	switch(timing)
+	{
+	case T_FRAME:
+		return "frame";
+	case T_UPDATE:
+		return "update";
+	case T_PLAYER:
+		return "player";
+	case T_SCENE:
+		return "scene";
+	case T_DRAW:
+		return "draw";
+	case T_WAIT:
+		return "wait";
+	default:
+		return "";
+	}
+}
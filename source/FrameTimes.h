@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+// Timings of last SIZE frames in ring buffer, used to look at frame time tail (percentiles, hitches) instead of average fps.
+// Main thread is the only writer and publishes frame after all its timings are set, so readers don't need locks.
+// Frame time is measured between BeginFrame calls, draw is time from EndUpdate to next BeginFrame (render & present),
+// wait is part of it from EndDraw (gui is drawn last) to next BeginFrame (present, vsync).
+class FrameTimes
+{
+public:
+	enum Timing
+	{
+		T_FRAME,
+		T_UPDATE,
+		T_PLAYER,
+		T_SCENE,
+		T_DRAW,
+		T_WAIT,
+		T_MAX
+	};
+
+	struct Frame
+	{
+		float time[T_MAX]; // in seconds
+
+		float GetWorkTime() const { return time[T_FRAME] - time[T_WAIT]; }
+	};
+
+	struct Summary
+	{
+		float p50, p95, p99, max;
+	};
+
+	static const uint SIZE = 1024;
+
+	FrameTimes();
+	void BeginFrame();
+	void EndUpdate();
+	void EndDraw();
+	void Add(Timing timing, float time) { current.time[timing] += time; }
+	uint GetWritten() const { return written.load(std::memory_order_acquire); }
+	const Frame& GetLast() const { return frames[(GetWritten() - 1) % SIZE]; } // only when GetWritten() != 0
+	void Copy(vector<Frame>& out, uint count) const; // last frames, oldest first
+	static Summary Summarize(const vector<Frame>& frames, Timing timing);
+	bool SaveCsv(cstring path) const;
+	static cstring GetName(Timing timing);
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	Frame frames[SIZE];
+	std::atomic<uint> written;
+	Frame current;
+	Clock::time_point frame_start, update_end, draw_end;
+	bool started, drawn;
+};
+
+// adds scope time to current frame
+class FrameTimer
+{
+public:
+	FrameTimer(FrameTimes* times, FrameTimes::Timing timing) : times(times), timing(timing), start(std::chrono::steady_clock::now()) {}
+	~FrameTimer() { times->Add(timing, std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count()); }
+
+private:
+	FrameTimes* times;
+	FrameTimes::Timing timing;
+	std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,149 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "FrustumCulling.h"
+#include <xmmintrin.h>
+
+const float FrustumCulling::HIDDEN = -1e30f;
+
+FrustumCulling::FrustumCulling() : count(0)
+{
+	for(uint i = 0; i < 6; ++i)
+	{
+		for(uint j = 0; j < 4; ++j)
+			planes[i][j] = 0.f;
+	}
+}
+
+void FrustumCulling::Reserve(uint new_count)
+{
+	const uint size = (new_count + 3) & ~3u;
+	x.reserve(size);
+	y.reserve(size);
+	z.reserve(size);
+	r.reserve(size);
+	masks.reserve(size / 4);
+	visible.reserve(new_count);
+}
+
+uint FrustumCulling::Add(const Vec3& center, float radius)
+{
+	if(count % 4 == 0)
+	{
+		x.resize(count + 4, 0.f);
+		y.resize(count + 4, 0.f);
+		z.resize(count + 4, 0.f);
+		r.resize(count + 4, HIDDEN);
+		masks.push_back(0);
+	}
+	Set(count, center, radius);
+	return count++;
+}
+
+void FrustumCulling::Set(uint index, const Vec3& center, float radius)
+{
+	x[index] = center.x;
+	y[index] = center.y;
+	z[index] = center.z;
+	r[index] = radius;
+}
+
+// planes from row vector view projection matrix (clip z in [0,w]), normalized so distance is in world units
+void FrustumCulling::SetFrustum(const Matrix& m)
+{
+	const float p[6][4] = {
+		{ m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41 }, // left
+		{ m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41 }, // right
+		{ m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42 }, // bottom
+		{ m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42 }, // top
+		{ m._13, m._23, m._33, m._43 }, // near
+		{ m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43 } // far
+	};
+	for(uint i = 0; i < 6; ++i)
+	{
+		const float inv_length = 1.f / sqrt(p[i][0] * p[i][0] + p[i][1] * p[i][1] + p[i][2] * p[i][2]);
+		for(uint j = 0; j < 4; ++j)
+			planes[i][j] = p[i][j] * inv_length;
+	}
+}
+
+void FrustumCulling::Cull()
+{
+	visible.clear();
+	shown.clear();
+	hidden.clear();
+
+	__m128 pa[6], pb[6], pc[6], pd[6];
+	for(uint i = 0; i < 6; ++i)
+	{
+		pa[i] = _mm_set1_ps(planes[i][0]);
+		pb[i] = _mm_set1_ps(planes[i][1]);
+		pc[i] = _mm_set1_ps(planes[i][2]);
+		pd[i] = _mm_set1_ps(planes[i][3]);
+	}
+
+	const uint blocks = (uint)masks.size();
+	for(uint block = 0; block < blocks; ++block)
+	{
+		const uint i = block * 4;
+		const __m128 bx = _mm_loadu_ps(&x[i]);
+		const __m128 by = _mm_loadu_ps(&y[i]);
+		const __m128 bz = _mm_loadu_ps(&z[i]);
+		const __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&r[i]));
+
+		// sphere is visible when it is not fully behind any plane: dot(n, center) + d >= -radius
+		auto test_plane = [&](uint p)
+		{
+			const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(pa[p], bx), _mm_mul_ps(pb[p], by)), _mm_mul_ps(pc[p], bz)), pd[p]);
+			return _mm_cmpge_ps(dist, neg_r);
+		};
+		__m128 inside = test_plane(0);
+		for(uint p = 1; p < 6; ++p)
+			inside = _mm_and_ps(inside, test_plane(p));
+		SetMask(block, (uint)_mm_movemask_ps(inside));
+	}
+}
+
+void FrustumCulling::CullScalar()
+{
+	visible.clear();
+	shown.clear();
+	hidden.clear();
+
+	const uint blocks = (uint)masks.size();
+	for(uint block = 0; block < blocks; ++block)
+	{
+		uint mask = 0;
+		for(uint j = 0; j < 4; ++j)
+		{
+			const uint i = block * 4 + j;
+			bool inside = true;
+			for(uint p = 0; p < 6 && inside; ++p)
+			{
+				const float dist = planes[p][0] * x[i] + planes[p][1] * y[i] + planes[p][2] * z[i] + planes[p][3];
+				inside = dist >= -r[i];
+			}
+			if(inside)
+				mask |= 1 << j;
+		}
+		SetMask(block, mask);
+	}
+}
+
+void FrustumCulling::SetMask(uint block, uint mask)
+{
+	const uint changed = masks[block] ^ mask;
+	masks[block] = (byte)mask;
+	for(uint j = 0; j < 4; ++j)
+	{
+		const uint bit = 1 << j;
+		if(mask & bit)
+			visible.push_back(block * 4 + j);
+		if(changed & bit)
+		{
+			if(mask & bit)
+				shown.push_back(block * 4 + j);
+			else
+				hidden.push_back(block * 4 + j);
+		}
+	}
+}
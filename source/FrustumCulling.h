@@ -0,0 +1,32 @@
+#pragma once
+
+// CPU frustum culling of bounding spheres. Spheres are kept in structure of arrays padded to blocks of 4,
+// Cull tests whole block against each plane with SSE. Doesn't depend on scene or render so can run headless.
+// After Cull, shown & hidden contain indices that changed visibility since previous Cull.
+class FrustumCulling
+{
+public:
+	static const float HIDDEN; // radius of sphere that is never visible
+
+	FrustumCulling();
+	void Reserve(uint count);
+	uint Add(const Vec3& center, float radius);
+	void Set(uint index, const Vec3& center, float radius);
+	void SetFrustum(const Matrix& view_proj);
+	void Cull();
+	void CullScalar(); // reference implementation, same results as Cull
+	uint GetCount() const { return count; }
+	bool IsVisible(uint index) const { return IsSet(masks[index / 4], 1 << (index % 4)); }
+	const vector<uint>& GetVisible() const { return visible; }
+	const vector<uint>& GetShown() const { return shown; }
+	const vector<uint>& GetHidden() const { return hidden; }
+
+private:
+	void SetMask(uint block, uint mask);
+
+	float planes[6][4]; // normal & distance, normal points inside
+	vector<float> x, y, z, r; // size is multiple of 4, padding is never visible
+	vector<byte> masks; // visible bits for each block of 4
+	vector<uint> visible, shown, hidden;
+	uint count;
+};
@@ -12,12 +12,34 @@
 #include <ResourceManager.h>
 #include <MeshInstance.h>
 #include "Player.h"
+#include "QualityGovernor.h"
+#include "AnimationMachine.h"
+#include "AnimationLod.h"
+#include "AsyncLoader.h"
+#include "FrustumCulling.h"
+#include "LightClusters.h"
 #include "GameCamera.h"
+#include "CharacterControllerSystem.h"
+#include "InputRecording.h"
+#include "Level.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 #include <Physics.h>
+#include <map>
 
 Game* game;
+// max simulation ticks per frame, after long hitch simulation is slowed down instead of spiraling
+const uint MAX_TICKS_PER_FRAME = 5;
+// max time per frame spent finishing loaded resources on main thread
+const float LOAD_BUDGET = 0.004f;
+// frames saved by trace dump hotkey
+const uint TRACE_FRAMES = 120;
+cstring TRACE_PATH = "trace.json";
+cstring TRACE_STARTUP_PATH = "trace_startup.json";
+cstring FRAME_TIMES_PATH = "frame_times.csv";
+const float LIGHT_RANGE = 5.f;
 
-Game::Game() : engine(new Engine), player(nullptr)
+Game::Game() : engine(new Engine), loader(nullptr), level(nullptr), human_anim(nullptr), anim_lod(nullptr), culling(nullptr), shown_nodes(0), light_clusters(nullptr), frame_times(nullptr), quality(nullptr), controllers(nullptr), thread_pool(nullptr), player(nullptr), recording(nullptr), trace_startup(false), target_frame_time(1.f / 60), auto_quality(true)
 {
 	game = this;
 }
@@ -37,69 +59,68 @@ void Game::Run()
 
 bool Game::OnInit()
 {
+	TRACE_ZONE("Game::OnInit");
 	app::res_mgr->AddDir("data");
 
 	scene = new Scene;
-	scene->ambient_color = Color(0.4f, 0.4f, 0.4f);
-	scene->clear_color = Color(0.1f, 0.1f, 0.1f);
-	scene->fog_color = Color(0.1f, 0.1f, 0.1f);
-	scene->fog_range = Vec2(5, 10);
 	app::scene_mgr->Add(scene);
 	app::scene_mgr->SetActive(scene);
 	app::scene_mgr->normal_map_enabled = false;
 	app::scene_mgr->specular_map_enabled = false;
 
-	light = SceneNode::Get();
-	light->tint = Vec4(1, 0, 0, 1);
-	light->SetLight(5);
-	scene->Add(light);
+	frame_times = new FrameTimes;
 
-	light2 = SceneNode::Get();
-	light2->tint = Vec4(0, 1, 0, 1);
-	light2->SetLight(5);
-	scene->Add(light2);
+	// meshes are loaded in background while rest of init runs, nodes are shown when their mesh is ready
+	loader = new AsyncLoader(2);
 
-	light3 = SceneNode::Get();
-	light3->tint = Vec4(0, 0, 1, 1);
-	light3->SetLight(5);
-	scene->Add(light3);
+	// static nodes are culled each frame, stay hidden until mesh is loaded
+	culling = new FrustumCulling;
+
+	// level file is baked with -bake, without it same level is created by code
+	level = new Level(app::physics->GetWorld());
+	if(level->Load(LEVEL_PATH, scene))
+	{
+		light = level->GetLight(0);
+		light2 = level->GetLight(1);
+		light3 = level->GetLight(2);
+		node = level->FindNode("skrzynka.qmsh");
+	}
+	else
+		CreateDefaultLevel();
+
+	LoadLevelMeshes();
+
+	// point lights are binned into 16x9 tiles x 24 depth slices; renderer doesn't use clusters yet (shaders pick lights
+	// per object), so they are built only for info overlay stats, -bench -lights measures the cost
+	light_clusters = new LightClusters(16, 9, 24);
+	if(level->GetLightCount() != 0)
+	{
+		for(uint i = 0; i < level->GetLightCount(); ++i)
+			AddClusterLight(level->GetLight(i), level->GetLightRange(i));
+	}
+	else
+	{
+		AddClusterLight(light, LIGHT_RANGE);
+		AddClusterLight(light2, LIGHT_RANGE);
+		AddClusterLight(light3, LIGHT_RANGE);
+	}
 
-	node = SceneNode::Get();
-	node->pos = Vec3::Zero;
-	node->rot = Vec3::Zero;
-	node->SetMesh(app::res_mgr->Load<Mesh>("floor.qmsh"));
-	node->mesh_inst = nullptr;
-	scene->Add(node);
-
-	btBoxShape* shape_floor = new btBoxShape(btVector3(8, 0.01f, 8));
-	app::physics->AddShape(shape_floor);
-
-	btCollisionObject* cobj = new btCollisionObject;
-	cobj->setCollisionShape(shape_floor);
-	cobj->setCollisionFlags(btCollisionObject::CF_STATIC_OBJECT);
-	cobj->getWorldTransform().setOrigin(btVector3(0.f, -0.005f, 0.f));
-	app::physics->GetWorld()->addCollisionObject(cobj, CG_LEVEL);
-
-	node = SceneNode::Get();
-	node->pos = Vec3(-2, 0, 0);
-	node->rot = Vec3::Zero;
-	node->SetMesh(app::res_mgr->Load<Mesh>("tarcza_strzelnicza.qmsh"));
-	scene->Add(node);
-
-	node = SceneNode::Get();
-	node->pos = Vec3(-1, 0, 2);
-	node->rot = Vec3::Zero;
-	node->SetMesh(app::res_mgr->Load<Mesh>("intensiv.qmsh"));
-	scene->Add(node);
-
-	node = SceneNode::Get();
-	node->pos = Vec3::Zero;
-	node->rot = Vec3::Zero;
-	node->SetMesh(app::res_mgr->Load<Mesh>("skrzynka.qmsh"));
-	scene->Add(node);
-
-	player = new Player;
-	scene->Add(player->node);
+	thread_pool = new ThreadPool(ThreadPool::GetDefaultThreadCount());
+	controllers = new CharacterControllerSystem(app::physics->GetWorld());
+	controllers->SetThreadPool(thread_pool);
+
+	// player node is shown when mesh is loaded, animation machine file is optional, default one matches human.qmsh
+	human_anim = new AnimationMachine;
+	player = new Player(controllers, human_anim, false);
+	anim_lod = new AnimationLod;
+	loader->Load<Mesh>("human.qmsh", AsyncLoader::PRIORITY_HIGH, [this](Mesh* mesh)
+	{
+		if(!human_anim->Load(HUMAN_ANIM_PATH, mesh))
+			human_anim->SetDefault(mesh);
+		anim_lod->Add(player->node, mesh);
+		player->StartAnimation();
+		AddNode(player->node);
+	});
 
 	camera = new GameCamera;
 	camera->target = player->node;
@@ -109,21 +130,153 @@ bool Game::OnInit()
 	fps_camera = new FpsCamera;
 	app::scene_mgr->Add(fps_camera);
 
+	// cheapest visual loss first, applied in order when frame time stays over target
+	quality = new QualityGovernor(target_frame_time);
+	quality->AddSwitch("specular map", app::scene_mgr->specular_map_enabled);
+	quality->AddSwitch("normal map", app::scene_mgr->normal_map_enabled);
+	const float lod_near_dist = anim_lod->near_dist, lod_far_dist = anim_lod->far_dist;
+	quality->AddStep("animation lod distance", [this, lod_near_dist, lod_far_dist](bool reduced)
+	{
+		anim_lod->near_dist = reduced ? lod_near_dist / 2 : lod_near_dist;
+		anim_lod->far_dist = reduced ? lod_far_dist / 2 : lod_far_dist;
+	});
+	quality->AddSwitch("fog", scene->use_fog);
+	quality->AddSwitch("point light", scene->use_point_light);
+	quality->AddSwitch("dir light", scene->use_dir_light);
+
 	game_gui = new GameGui();
 	app::gui->Add(game_gui);
 
 	light_rot = 0;
+	tick_time = 0;
+	jump_queued = false;
+	if(!record_path.empty())
+		recording = new InputRecording;
 
 	return true;
 }
 
+void Game::CreateDefaultLevel()
+{
+	TRACE_ZONE("Game::CreateDefaultLevel");
+	scene->ambient_color = Color(0.4f, 0.4f, 0.4f);
+	scene->clear_color = Color(0.1f, 0.1f, 0.1f);
+	scene->fog_color = Color(0.1f, 0.1f, 0.1f);
+	scene->fog_range = Vec2(5, 10);
+
+	light = SceneNode::Get();
+	light->tint = Vec4(1, 0, 0, 1);
+	light->SetLight(LIGHT_RANGE);
+	scene->Add(light);
+
+	light2 = SceneNode::Get();
+	light2->tint = Vec4(0, 1, 0, 1);
+	light2->SetLight(LIGHT_RANGE);
+	scene->Add(light2);
+
+	light3 = SceneNode::Get();
+	light3->tint = Vec4(0, 0, 1, 1);
+	light3->SetLight(LIGHT_RANGE);
+	scene->Add(light3);
+
+	AddMeshNode("floor.qmsh", Vec3::Zero, AsyncLoader::PRIORITY_HIGH);
+
+	level->CreateCollision();
+
+	AddMeshNode("tarcza_strzelnicza.qmsh", Vec3(-2, 0, 0), AsyncLoader::PRIORITY_NORMAL);
+	AddMeshNode("intensiv.qmsh", Vec3(-1, 0, 2), AsyncLoader::PRIORITY_NORMAL);
+	node = AddMeshNode("skrzynka.qmsh", Vec3::Zero, AsyncLoader::PRIORITY_NORMAL);
+}
+
+// node is culled (added to scene when visible) after mesh is loaded
+SceneNode* Game::AddMeshNode(cstring mesh, const Vec3& pos, AsyncLoader::Priority priority)
+{
+	SceneNode* new_node = SceneNode::Get();
+	new_node->pos = pos;
+	new_node->rot = Vec3::Zero;
+	new_node->mesh = nullptr;
+	new_node->mesh_inst = nullptr;
+	const uint index = AddCulledNode(new_node);
+	loader->Load<Mesh>(mesh, priority, [this, new_node, index](Mesh* mesh)
+	{
+		// mesh radius is around origin so rotation doesn't matter
+		new_node->SetMesh(mesh);
+		culling->Set(index, new_node->pos, mesh->head.radius);
+	});
+	return new_node;
+}
+
+// node without mesh is hidden until culling->Set, returns culling index
+uint Game::AddCulledNode(SceneNode* node)
+{
+	culled_nodes.push_back(node);
+	return culling->Add(node->pos, FrustumCulling::HIDDEN);
+}
+
+// one request for each mesh used by level nodes, node can be culled after its mesh is loaded
+void Game::LoadLevelMeshes()
+{
+	TRACE_ZONE("Game::LoadLevelMeshes");
+	culling->Reserve(culling->GetCount() + level->GetNodeCount());
+	std::map<string, vector<uint>> mesh_nodes; // culling indices of nodes using mesh
+	for(uint i = 0; i < level->GetNodeCount(); ++i)
+		mesh_nodes[level->GetNodeMesh(i)].push_back(AddCulledNode(level->GetNode(i)));
+	for(std::pair<const string, vector<uint>>& it : mesh_nodes)
+	{
+		const vector<uint>& indices = it.second;
+		loader->Load<Mesh>(it.first, AsyncLoader::PRIORITY_NORMAL, [this, indices](Mesh* mesh)
+		{
+			for(uint index : indices)
+			{
+				// mesh radius is around origin so rotation doesn't matter
+				SceneNode* culled_node = culled_nodes[index];
+				culled_node->SetMesh(mesh);
+				culling->Set(index, culled_node->pos, mesh->head.radius);
+			}
+		});
+	}
+}
+
 void Game::OnCleanup()
 {
+	if(recording)
+	{
+		if(recording->Save(record_path.c_str()))
+			Info(Format("Game: Saved recording '%s' (%u ticks).", record_path.c_str(), recording->GetCount()));
+		else
+			Error(Format("Game: Failed to save recording '%s'.", record_path.c_str()));
+		delete recording;
+	}
+	// cancel loading before nodes are freed, callbacks won't be called
+	delete loader;
+	loader = nullptr;
+	if(!player->node->mesh_inst)
+		player->node->Free();
+
+	// culled nodes are not in scene, scene frees only visible ones
+	for(uint i = 0; i < culling->GetCount(); ++i)
+	{
+		if(!culling->IsVisible(i))
+			culled_nodes[i]->Free();
+	}
+	delete culling;
+	delete light_clusters;
+	delete frame_times;
+	delete quality;
+	delete anim_lod;
 	delete player;
+	delete human_anim;
+	delete controllers;
+	delete thread_pool;
+	delete level;
 }
 
 void Game::OnUpdate(float dt)
 {
+	Trace::NextFrame();
+	frame_times->BeginFrame();
+	TRACE_ZONE("Game::OnUpdate");
+
 	if(app::input->Shortcut(KEY_ALT, Key::F4) || app::input->Down(Key::Escape))
 		engine->Shutdown();
 	if(app::input->Shortcut(KEY_ALT, Key::Enter))
@@ -134,26 +287,146 @@ void Game::OnUpdate(float dt)
 		engine->SetWindowSize(Int2(1280, 1080));
 	if(app::input->Shortcut(KEY_CONTROL, Key::U))
 		engine->UnlockCursor();
+	if(app::input->Pressed(Key::F10))
+		Trace::Enable(!Trace::IsEnabled());
+	if(app::input->Pressed(Key::F11))
+	{
+		if(Trace::Dump(TRACE_PATH, TRACE_FRAMES))
+			Info(Format("Game: Saved last %u frames trace to '%s'.", TRACE_FRAMES, TRACE_PATH));
+		else
+			Error(Format("Game: Failed to save trace '%s'.", TRACE_PATH));
+	}
+	if(app::input->Pressed(Key::F3))
+	{
+		if(frame_times->SaveCsv(FRAME_TIMES_PATH))
+			Info(Format("Game: Saved frame times to '%s'.", FRAME_TIMES_PATH));
+		else
+			Error(Format("Game: Failed to save frame times '%s'.", FRAME_TIMES_PATH));
+	}
+	if(app::input->Pressed(Key::F6))
+	{
+		auto_quality = !auto_quality;
+		if(!auto_quality)
+			quality->SetLevel(0);
+	}
+	if(auto_quality && frame_times->GetWritten() != 0)
+	{
+		// with vsync frame time can't get below target, work time (without present wait) shows free time
+		const FrameTimes::Frame& last = frame_times->GetLast();
+		const int change = quality->Update(last.time[FrameTimes::T_FRAME], last.GetWorkTime());
+		if(change < 0)
+			Info(Format("Game: Quality reduced, %s off (frame time %.1f ms).", quality->GetStepName(quality->GetLevel() - 1), quality->GetSmoothedTime() * 1000));
+		else if(change > 0)
+			Info(Format("Game: Quality raised, %s on (work time %.1f ms).", quality->GetStepName(quality->GetLevel()), quality->GetSmoothedWorkTime() * 1000));
+	}
+
+	loader->Update(LOAD_BUDGET);
+	if(trace_startup && loader->GetPendingCount() == 0)
+	{
+		// startup ends when all meshes requested in OnInit are loaded
+		trace_startup = false;
+		if(Trace::Dump(TRACE_STARTUP_PATH, 0))
+			Info(Format("Game: Saved startup trace to '%s'.", TRACE_STARTUP_PATH));
+		else
+			Error(Format("Game: Failed to save trace '%s'.", TRACE_STARTUP_PATH));
+	}
 
-	player->Update(dt);
+	// simulation runs at fixed tick so it is same at any frame rate, rendering interpolates between last two ticks
+	PlayerInput input = PlayerInput::FromKeyboard();
+	if(input.jump)
+		jump_queued = true;
+	{
+		FrameTimer timer(frame_times, FrameTimes::T_PLAYER);
+		tick_time += dt;
+		uint ticks = 0;
+		while(tick_time >= TICK)
+		{
+			tick_time -= TICK;
+			if(++ticks > MAX_TICKS_PER_FRAME)
+			{
+				tick_time = 0;
+				break;
+			}
+			input.jump = jump_queued;
+			jump_queued = false;
+			player->Update(TICK, input);
+			controllers->Update(TICK);
+			player->PostUpdate();
+			if(recording)
+				recording->Add(input, InputRecording::Checksum(player->controller->getPos()));
+		}
+	}
+	player->Interpolate(tick_time / TICK);
 
 	if(app::scene_mgr->GetActiveCamera() == camera)
 		camera->Update(dt, true);
 	else
 		fps_camera->Update(dt);
-
-	if(!app::input->Down(Key::Backspace))
 	{
-		node->rot.y += dt * 3;
-		app::scene_mgr->Update(dt);
+		// replaces scene_mgr->Update, mesh instances are animated only by anim_lod
+		TRACE_ZONE("Game::UpdateScene");
+		FrameTimer timer(frame_times, FrameTimes::T_SCENE);
+		UpdateCulling();
+
+		if(!app::input->Down(Key::Backspace))
+		{
+			if(node)
+				node->rot.y += dt * 3;
+			anim_lod->Update(dt, *app::scene_mgr->GetActiveCamera());
 
-		light_rot += dt;
-		scene->light_dir = Vec3(sin(light_rot) * 4, 10, cos(light_rot) * 6).Normalized();
+			light_rot += dt;
+			scene->light_dir = Vec3(sin(light_rot) * 4, 10, cos(light_rot) * 6).Normalized();
 
-		light->pos = Vec3(cos(light_rot) * 3, 2, sin(light_rot) * 3);
+			light->pos = Vec3(cos(light_rot) * 3, 2, sin(light_rot) * 3);
 
-		light2->pos = Vec3(cos(light_rot * 1.5f + PI / 2) * 3, 2, sin(light_rot * 1.5f + PI / 2) * 3);
+			light2->pos = Vec3(cos(light_rot * 1.5f + PI / 2) * 3, 2, sin(light_rot * 1.5f + PI / 2) * 3);
 
-		light3->pos = Vec3(cos(-light_rot * 0.7f + PI ) * 3, 2, sin(-light_rot * 0.7f + PI) * 3);
+			light3->pos = Vec3(cos(-light_rot * 0.7f + PI ) * 3, 2, sin(-light_rot * 0.7f + PI) * 3);
+		}
+		if(game_gui->IsInfoVisible())
+			UpdateLightClusters();
 	}
+	frame_times->EndUpdate();
+}
+
+// add node that isn't culled to scene, before visible culled nodes so they stay at end
+void Game::AddNode(SceneNode* node)
+{
+	vector<SceneNode*>& nodes = scene->nodes;
+	nodes.insert(nodes.end() - shown_nodes, node);
+}
+
+// replace culled nodes at end of scene nodes with visible list in one pass, so renderer gets only visible nodes
+void Game::UpdateCulling()
+{
+	TRACE_ZONE("Game::UpdateCulling");
+	const Camera& cam = *app::scene_mgr->GetActiveCamera();
+	culling->SetFrustum(Matrix::CreateLookAt(cam.from, cam.to, cam.up) * Matrix::CreatePerspectiveFieldOfView(cam.fov, cam.aspect, cam.znear, cam.zfar));
+	culling->Cull();
+	if(culling->GetShown().empty() && culling->GetHidden().empty())
+		return;
+	vector<SceneNode*>& nodes = scene->nodes;
+	nodes.resize(nodes.size() - shown_nodes);
+	for(uint index : culling->GetVisible())
+		nodes.push_back(culled_nodes[index]);
+	shown_nodes = (uint)culling->GetVisible().size();
+}
+
+void Game::AddClusterLight(SceneNode* node, float range)
+{
+	LightClusters::Light light;
+	light.pos = node->pos;
+	light.range = range;
+	cluster_lights.push_back(light);
+	cluster_light_nodes.push_back(node);
+}
+
+void Game::UpdateLightClusters()
+{
+	TRACE_ZONE("Game::UpdateLightClusters");
+	const Camera& cam = *app::scene_mgr->GetActiveCamera();
+	for(uint i = 0; i < (uint)cluster_lights.size(); ++i)
+		cluster_lights[i].pos = cluster_light_nodes[i]->pos;
+	light_clusters->SetCamera(cam.from, cam.to, cam.up, cam.fov, cam.aspect, cam.znear, cam.zfar);
+	light_clusters->Build(cluster_lights, thread_pool);
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <App.h>
+#include "AsyncLoader.h"
+#include "FrameTimes.h"
+#include "LightClusters.h"
 
 class Game : public App
 {
@@ -11,6 +14,14 @@ public:
 	bool OnInit() override;
 	void OnCleanup() override;
 	void OnUpdate(float dt) override;
+	void CreateDefaultLevel();
+	SceneNode* AddMeshNode(cstring mesh, const Vec3& pos, AsyncLoader::Priority priority);
+	uint AddCulledNode(SceneNode* node);
+	void AddNode(SceneNode* node);
+	void LoadLevelMeshes();
+	void UpdateCulling();
+	void AddClusterLight(SceneNode* node, float range);
+	void UpdateLightClusters();
 
 	Engine* engine;
 	GameCamera* camera;
@@ -19,6 +30,27 @@ public:
 	Scene* scene;
 	SceneNode* node;
 	SceneNode* light, *light2, *light3;
+	AsyncLoader* loader;
+	Level* level;
+	AnimationMachine* human_anim;
+	AnimationLod* anim_lod;
+	FrustumCulling* culling;
+	vector<SceneNode*> culled_nodes; // same indices as in culling
+	uint shown_nodes; // visible culled nodes, they are kept at end of scene nodes
+	LightClusters* light_clusters;
+	vector<LightClusters::Light> cluster_lights;
+	vector<SceneNode*> cluster_light_nodes;
+	FrameTimes* frame_times;
+	QualityGovernor* quality;
+	CharacterControllerSystem* controllers;
+	ThreadPool* thread_pool;
 	Player* player;
 	float light_rot;
+	float tick_time; // not simulated time carried to next frame
+	bool jump_queued; // jump pressed in frame without simulation tick
+	string record_path; // when set, input of every tick is recorded and saved on exit
+	InputRecording* recording;
+	bool trace_startup; // tracing is enabled from start, dumped when startup loading is done
+	float target_frame_time; // auto quality keeps frame time below it
+	bool auto_quality;
 };
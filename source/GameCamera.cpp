@@ -3,6 +3,7 @@
 #include "GameCamera.h"
 #include <Input.h>
 #include <SceneNode.h>
+#include "Trace.h"
 
 const Vec2 GameCamera::c_angle = Vec2(3.24f, 5.75f);
 
@@ -18,6 +19,7 @@ GameCamera::GameCamera()
 
 void GameCamera::Update(float dt, bool allow_mouse)
 {
+	TRACE_ZONE("GameCamera::Update");
 	if(allow_mouse)
 	{
 		dist -= 0.25f * app::input->GetMouseWheel();
@@ -2,12 +2,30 @@
 
 #include <EngineCore.h>
 
+class AiBrain;
+class AnimationLod;
+class AnimationMachine;
+class AsyncLoader;
+class BakedCollision;
+class CharacterControllerSystem;
+class CmdLine;
+class CollisionWorld;
+class FrustumCulling;
 class Game;
 class GameGui;
+class InputRecording;
+class Level;
+class LightClusters;
+class MappedFile;
+class QualityGovernor;
+class Simulation;
+class Terrain;
+class ThreadPool;
 
 struct CharacterController;
 struct GameCamera;
 struct Player;
+struct PlayerInput;
 
 enum COLLISION_GROUP
 {
@@ -15,4 +33,7 @@ enum COLLISION_GROUP
 	CG_UNIT = 1 << 1
 };
 
+// fixed simulation time step
+const float TICK = 1.f / 60;
+
 extern Game* game;
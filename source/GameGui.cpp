@@ -9,49 +9,208 @@
 #include "Game.h"
 #include <FpsCamera.h>
 #include "GameCamera.h"
+#include "CharacterControllerSystem.h"
+#include "AnimationLod.h"
+#include "AsyncLoader.h"
+#include "FrustumCulling.h"
+#include "LightClusters.h"
+#include "QualityGovernor.h"
+#include "Trace.h"
 
-GameGui::GameGui() : scene(game->scene), show_info(false)
+GameGui::GameGui() : font(gui->GetFont("Arial", 16, 6)), scene(game->scene), text_fps(font), text_info(font), text_help(font),
+	text_short(font), text_times(font), show_info(false), show_times(false)
+#if CC_PROFILE
+	, text_stats(font), stats_index(0), stats_count(0), stats_frame(0)
+#endif
 {
-	font = gui->GetFont("Arial", 16, 6);
+	text_short.SetText("---------------\n[F1] Show help");
 }
 
+// text is formatted & laid out only when shown values change, most frames only draw cached lines
 void GameGui::Draw(ControlDrawData*)
 {
-	cstring text;
+	TRACE_ZONE("GameGui::Draw");
+	TextBlock* blocks[4];
+	uint count = 0;
+
+	const float fps = FLT10(app::engine->GetFps());
+	text_fps.Update(TextBlock::Key(fps), [fps] { return Format("Fps: %g", fps); });
+	blocks[count++] = &text_fps;
+
+#if CC_PROFILE
+	text_stats.Update(TextBlock::Key(stats_frame / STATS_REFRESH), [this] { return GetStatsText(); });
+	blocks[count++] = &text_stats;
+#endif
+
 	if(show_info)
 	{
-		text = Format("Fps: %g\n"
-			"[WSAD] Move\n"
-			"[Spacebar] Jump\n"
-			"[Shift] Walk\n"
-			"[Backspace] Stop animations\n"
-			"[F] Toggle fps camera\n"
-			"---------------\n"
-			"[1] Fog %s\n"
-			"[2] Dir light %s\n"
-			"[3] Point light %s\n"
-			"[4] Normal map %s\n"
-			"[5] Specular map %s\n"
-			"---------------\n"
-			"[F1] Hide help",
-			FLT10(app::engine->GetFps()),
-			app::scene_mgr->fog_enabled ? "ON" : "OFF",
-			scene->use_dir_light ? "ON" : "OFF",
-			scene->use_point_light ? "ON" : "OFF",
-			app::scene_mgr->normal_map_enabled ? "ON" : "OFF",
-			app::scene_mgr->specular_map_enabled ? "ON" : "OFF");
+		const AnimationLod* lod = game->anim_lod;
+		const FrustumCulling* culling = game->culling;
+		const LightClusters* clusters = game->light_clusters;
+		const uint lod_near = lod->GetLevelCount(AnimationLod::LOD_NEAR), lod_mid = lod->GetLevelCount(AnimationLod::LOD_MID),
+			lod_far = lod->GetLevelCount(AnimationLod::LOD_FAR), lod_hidden = lod->GetLevelCount(AnimationLod::LOD_HIDDEN),
+			lod_sampled = lod->GetSampledCount();
+		const uint visible = (uint)culling->GetVisible().size(), culled = culling->GetCount() - visible,
+			loading = game->loader->GetPendingCount();
+		const uint lights = (uint)game->cluster_lights.size(), used_clusters = clusters->GetUsedClusterCount(),
+			max_lights = clusters->GetMaxLightsPerCluster();
+		text_info.Update(TextBlock::Key(lod_near, lod_mid, lod_far, lod_hidden, lod_sampled, visible, culled, loading, lights,
+			used_clusters, max_lights), [&]
+		{
+			return Format("Animation lod near/mid/far/hidden: %u/%u/%u/%u (sampled %u)\n"
+				"Level nodes: %u visible, %u culled, %u resources loading\n"
+				"Light clusters: %u lights, %u/%u used, max %u lights per cluster",
+				lod_near, lod_mid, lod_far, lod_hidden, lod_sampled,
+				visible, culled, loading,
+				lights, used_clusters, clusters->GetClusterCount(), max_lights);
+		});
+		blocks[count++] = &text_info;
+
+		const uint quality = game->quality->GetLevel(), quality_max = game->quality->GetMaxLevel();
+		const bool tracing = Trace::IsEnabled(), auto_quality = game->auto_quality, fog = app::scene_mgr->fog_enabled, dir_light = scene->use_dir_light,
+			point_light = scene->use_point_light, normal_map = app::scene_mgr->normal_map_enabled,
+			specular_map = app::scene_mgr->specular_map_enabled;
+		text_help.Update(TextBlock::Key(quality, quality_max, tracing, auto_quality, fog, dir_light, point_light, normal_map, specular_map), [&]
+		{
+			return Format("[WSAD] Move\n"
+				"[Spacebar] Jump\n"
+				"[Shift] Walk\n"
+				"[Backspace] Stop animations\n"
+				"[F] Toggle fps camera\n"
+				"[F10] Tracing %s\n"
+				"[F11] Save trace of last frames\n"
+				"[F2] Frame times\n"
+				"[F6] Auto quality %s (reduced %u/%u)\n"
+				"---------------\n"
+				"[1] Fog %s\n"
+				"[2] Dir light %s\n"
+				"[3] Point light %s\n"
+				"[4] Normal map %s\n"
+				"[5] Specular map %s\n"
+				"---------------\n"
+				"[F1] Hide help",
+				tracing ? "ON" : "OFF",
+				auto_quality ? "ON" : "OFF", quality, quality_max,
+				fog ? "ON" : "OFF",
+				dir_light ? "ON" : "OFF",
+				point_light ? "ON" : "OFF",
+				normal_map ? "ON" : "OFF",
+				specular_map ? "ON" : "OFF");
+		});
+		blocks[count++] = &text_help;
 	}
 	else
-		text = Format("Fps: %g\n---------------\n[F1] Show help", FLT10(app::engine->GetFps()));
-	Int2 size = font->CalculateSize(text);
+		blocks[count++] = &text_short;
+
+	Int2 size(0, 0);
+	for(uint i = 0; i < count; ++i)
+	{
+		size.x = Max(size.x, blocks[i]->GetSize().x);
+		size.y += blocks[i]->GetSize().y;
+	}
 	gui->DrawArea(Color(0, 0, 0, 128), Rect(0, 0, size.x + 6, size.y + 6));
-	gui->DrawText(font, text, DTF_OUTLINE, Color::White, Rect(2, 2, size.x + 4, size.y + 4));
+	Int2 pos(2, 2);
+	for(uint i = 0; i < count; ++i)
+	{
+		blocks[i]->Draw(pos, Color::White);
+		pos.y += blocks[i]->GetSize().y;
+	}
+
+	if(show_times)
+		DrawFrameTimes();
+
+	// gui is drawn last, rest of frame is present & vsync wait
+	game->frame_times->EndDraw();
+}
+
+// frame time graph & percentiles in bottom left corner, average fps hides hitches
+void GameGui::DrawFrameTimes()
+{
+	const float GRAPH_SCALE = 4000.f; // pixels per second
+	const float GRAPH_MAX_TIME = 0.05f;
+	const float TARGET_TIME = 1.f / 60;
+
+	const FrameTimes* times = game->frame_times;
+	times->Copy(frames, FrameTimes::SIZE);
+	text_times.Update(TextBlock::Key(times->GetWritten() / TIMES_REFRESH), [this]
+	{
+		string text = Format("Frame times of last %u frames, ms p50/p95/p99/max:", (uint)frames.size());
+		for(uint i = 0; i < FrameTimes::T_MAX; ++i)
+		{
+			const FrameTimes::Timing timing = (FrameTimes::Timing)i;
+			const FrameTimes::Summary summary = FrameTimes::Summarize(frames, timing);
+			text += Format("\n%s: %.2f/%.2f/%.2f/%.2f", FrameTimes::GetName(timing), summary.p50 * 1000, summary.p95 * 1000,
+				summary.p99 * 1000, summary.max * 1000);
+		}
+		text += "\n[F2] Hide frame times, [F3] Save to csv";
+		return text;
+	});
+
+	const int graph_height = int(GRAPH_MAX_TIME * GRAPH_SCALE);
+	const Int2& text_size = text_times.GetSize();
+	const int bottom = gui->wnd_size.y - 2;
+	const int top = bottom - graph_height - text_size.y - 4;
+	gui->DrawArea(Color(0, 0, 0, 128), Rect(0, top - 2, Max(text_size.x, (int)GRAPH_FRAMES * 2) + 6, bottom + 2));
+	text_times.Draw(Int2(2, top), Color::White);
+
+	for(uint i = 1; i <= 2; ++i)
+	{
+		const int y = bottom - int(TARGET_TIME * i * GRAPH_SCALE);
+		gui->DrawArea(Color(255, 255, 255, 64), Rect(2, y, 2 + GRAPH_FRAMES * 2, y + 1));
+	}
+	const uint first = frames.size() > GRAPH_FRAMES ? (uint)frames.size() - GRAPH_FRAMES : 0;
+	for(uint i = first; i < (uint)frames.size(); ++i)
+	{
+		const float time = frames[i].time[FrameTimes::T_FRAME];
+		const int height = Max(1, Min(int(time * GRAPH_SCALE), graph_height));
+		const Color color = time <= TARGET_TIME * 1.1f ? Color::Green : (time <= TARGET_TIME * 2.1f ? Color::Yellow : Color::Red);
+		const int x = 2 + (i - first) * 2;
+		gui->DrawArea(color, Rect(x, bottom - height, x + 2, bottom));
+	}
+}
+
+#if CC_PROFILE
+// rolling average & max of controller stats from last frames
+cstring GameGui::GetStatsText() const
+{
+	if(stats_count == 0)
+		return "";
+	CharacterController::Stats avg, max;
+	for(uint i = 0; i < stats_count; ++i)
+	{
+		avg.Add(stats[i]);
+		max.Max(stats[i]);
+	}
+	const float mul = 1.f / stats_count;
+	return Format("Controllers: %u (awake %u)\n"
+		"Sweeps up/fwd/down: %.1f/%.1f/%.1f (max %u/%u/%u), rays down: %.1f (max %u)\n"
+		"Forward iter: %.1f (max %u)\n"
+		"Penetration loops: %.1f (max %u), dispatch: %.1f (max %u)\n"
+		"Time up/fwd/down/pen: %.0f/%.0f/%.0f/%.0f us (max %.0f/%.0f/%.0f/%.0f)",
+		game->controllers->GetCount(), game->controllers->GetAwakeCount(),
+		mul * avg.sweeps_up, mul * avg.sweeps_forward, mul * avg.sweeps_down, max.sweeps_up, max.sweeps_forward, max.sweeps_down,
+		mul * avg.rays_down, max.rays_down,
+		mul * avg.forward_iterations, max.forward_iterations,
+		mul * avg.penetration_loops, max.penetration_loops, mul * avg.dispatches, max.dispatches,
+		mul * avg.time_up * 1e6f, mul * avg.time_forward * 1e6f, mul * avg.time_down * 1e6f, mul * avg.time_penetration * 1e6f,
+		max.time_up * 1e6f, max.time_forward * 1e6f, max.time_down * 1e6f, max.time_penetration * 1e6f);
 }
+#endif
 
 void GameGui::Update(float dt)
 {
+#if CC_PROFILE
+	stats[stats_index] = game->controllers->frame_stats;
+	stats_index = (stats_index + 1) % STATS_FRAMES;
+	if(stats_count < STATS_FRAMES)
+		++stats_count;
+	++stats_frame;
+#endif
+
 	if(app::input->Pressed(Key::F1))
 		show_info = !show_info;
+	if(app::input->Pressed(Key::F2))
+		show_times = !show_times;
 	if(app::input->Pressed(Key::N1))
 		scene->use_fog = !scene->use_fog;
 	if(app::input->Pressed(Key::N2))
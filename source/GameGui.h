@@ -1,6 +1,9 @@
 #pragma once
 
 #include <Control.h>
+#include "CharacterController.h"
+#include "FrameTimes.h"
+#include "TextBlock.h"
 
 class GameGui : public Control
 {
@@ -8,9 +11,28 @@ public:
 	GameGui();
 	void Draw(ControlDrawData*) override;
 	void Update(float dt) override;
+	bool IsInfoVisible() const { return show_info; }
 
 private:
+	static const uint TIMES_REFRESH = 10; // frames between percentiles updates
+	static const uint GRAPH_FRAMES = 240;
+
+	void DrawFrameTimes();
+#if CC_PROFILE
+	static const uint STATS_FRAMES = 60;
+	static const uint STATS_REFRESH = 10; // frames between stats text updates
+
+	cstring GetStatsText() const;
+#endif
+
 	Font* font;
 	Scene* scene;
-	bool show_info;
+	TextBlock text_fps, text_info, text_help, text_short, text_times;
+	vector<FrameTimes::Frame> frames;
+	bool show_info, show_times;
+#if CC_PROFILE
+	TextBlock text_stats;
+	CharacterController::Stats stats[STATS_FRAMES];
+	uint stats_index, stats_count, stats_frame;
+#endif
 };
@@ -0,0 +1,104 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "InputRecording.h"
+#include <fstream>
+
+namespace
+{
+	const char MAGIC[4] = { 'C', 'A', 'R', 'C' };
+	const uint VERSION = 1;
+	const uint TICK_SIZE = sizeof(float) + sizeof(char) + sizeof(byte) + sizeof(uint); // rot, dir, flags, checksum
+
+	enum TickFlags
+	{
+		TF_WALK = 1 << 0,
+		TF_JUMP = 1 << 1
+	};
+}
+
+void InputRecording::Add(const PlayerInput& input, uint checksum)
+{
+	Tick tick;
+	tick.input = input;
+	tick.checksum = checksum;
+	ticks.push_back(tick);
+}
+
+bool InputRecording::Save(cstring path) const
+{
+	std::ofstream file(path, std::ios::binary);
+	if(!file)
+		return false;
+
+	const uint count = GetCount();
+	file.write(MAGIC, sizeof(MAGIC));
+	file.write((const char*)&VERSION, sizeof(VERSION));
+	file.write((const char*)&count, sizeof(count));
+	for(const Tick& tick : ticks)
+	{
+		const char dir = (char)tick.input.dir;
+		byte flags = 0;
+		if(tick.input.walk)
+			flags |= TF_WALK;
+		if(tick.input.jump)
+			flags |= TF_JUMP;
+		file.write((const char*)&tick.input.rot, sizeof(tick.input.rot));
+		file.write(&dir, sizeof(dir));
+		file.write((const char*)&flags, sizeof(flags));
+		file.write((const char*)&tick.checksum, sizeof(tick.checksum));
+	}
+	return file.good();
+}
+
+bool InputRecording::Load(cstring path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if(!file)
+		return false;
+
+	char magic[4];
+	uint version, count;
+	file.read(magic, sizeof(magic));
+	file.read((char*)&version, sizeof(version));
+	file.read((char*)&count, sizeof(count));
+	if(!file || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || version != VERSION)
+		return false;
+
+	// count is checked against file size before allocating, corrupted header can't request huge buffer
+	const std::streamoff data_pos = file.tellg();
+	file.seekg(0, std::ios::end);
+	const std::streamoff remaining = file.tellg() - data_pos;
+	file.seekg(data_pos);
+	if(!file || (std::streamoff)count > remaining / TICK_SIZE)
+		return false;
+
+	ticks.resize(count);
+	for(Tick& tick : ticks)
+	{
+		char dir;
+		byte flags;
+		file.read((char*)&tick.input.rot, sizeof(tick.input.rot));
+		file.read(&dir, sizeof(dir));
+		file.read((char*)&flags, sizeof(flags));
+		file.read((char*)&tick.checksum, sizeof(tick.checksum));
+		tick.input.dir = dir;
+		tick.input.walk = IsSet(flags, TF_WALK);
+		tick.input.jump = IsSet(flags, TF_JUMP);
+	}
+	if(!file)
+	{
+		ticks.clear();
+		return false;
+	}
+	return true;
+}
+
+// FNV-1a of position bytes, any difference in trajectory changes it
+uint InputRecording::Checksum(const btVector3& pos)
+{
+	uint hash = 2166136261u;
+	const byte* data = reinterpret_cast<const byte*>(pos.m_floats);
+	for(uint i = 0; i < sizeof(btScalar) * 3; ++i)
+		hash = (hash ^ data[i]) * 16777619u;
+	return hash;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <btBulletCollisionCommon.h>
+#include "Player.h"
+
+// Player input stream recorded at fixed tick with checksum of controller position after each tick.
+// Binary file: header (magic, version, tick count) then per tick: rot (float), dir (int8), flags (byte), checksum (uint).
+class InputRecording
+{
+public:
+	struct Tick
+	{
+		PlayerInput input;
+		uint checksum;
+	};
+
+	void Add(const PlayerInput& input, uint checksum);
+	bool Save(cstring path) const;
+	bool Load(cstring path);
+	uint GetCount() const { return (uint)ticks.size(); }
+	const Tick& Get(uint index) const { return ticks[index]; }
+
+	static uint Checksum(const btVector3& pos);
+
+private:
+	vector<Tick> ticks;
+};
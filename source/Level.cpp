@@ -0,0 +1,236 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "Level.h"
+#include "BakedCollision.h"
+#include "MappedFile.h"
+#include "Terrain.h"
+#include "Trace.h"
+#include <File.h>
+#include <ResourceManager.h>
+#include <Scene.h>
+#include <SceneNode.h>
+
+namespace
+{
+	const uint BOX_SHAPE_SIZE = (sizeof(btBoxShape) + 15) & ~15u;
+	const uint BOX_OBJECT_SIZE = (sizeof(btCollisionObject) + 15) & ~15u;
+}
+
+Level::Level(btCollisionWorld* world) : world(world), file(nullptr), header(nullptr), baked(nullptr), box_block(nullptr), box_count(0), floor(nullptr)
+{
+}
+
+Level::~Level()
+{
+	for(btCollisionObject* obj : objects)
+	{
+		world->removeCollisionObject(obj);
+		delete obj;
+	}
+	for(btCollisionShape* shape : shapes)
+		delete shape;
+	for(Terrain* terrain : terrains)
+		delete terrain;
+	Unload();
+}
+
+// remove level file collision & unmap it
+void Level::Unload()
+{
+	for(uint i = 0; i < box_count; ++i)
+	{
+		btCollisionObject* obj = GetBoxObject(i);
+		world->removeCollisionObject(obj);
+		obj->~btCollisionObject();
+		GetBoxShape(i)->~btBoxShape();
+	}
+	if(box_block)
+	{
+		btAlignedFree(box_block);
+		box_block = nullptr;
+	}
+	box_count = 0;
+	floor = nullptr;
+	delete baked;
+	baked = nullptr;
+	delete file;
+	file = nullptr;
+	header = nullptr;
+}
+
+// collision of default test level when there is no level file (same for game and headless simulation)
+void Level::CreateCollision()
+{
+	floor_extents = btVector3(8, 0.01f, 8);
+	floor = AddBox(floor_extents, btVector3(0.f, -0.005f, 0.f));
+}
+
+// enlarge floor (first box of level) so it covers at least half_size around its center, floor is never shrunk
+void Level::SetFloorSize(float half_size)
+{
+	if(!floor)
+		return;
+	const btVector3 scale(Max(half_size, floor_extents.x()) / floor_extents.x(), 1.f, Max(half_size, floor_extents.z()) / floor_extents.z());
+	floor->getCollisionShape()->setLocalScaling(scale);
+	world->updateSingleAabb(floor);
+}
+
+// map level file and create collision, scene nodes & lights are created only when scene is set
+// returns false without error when file doesn't exist (level is created by code)
+bool Level::Load(cstring path, Scene* scene)
+{
+	TRACE_ZONE_DETAIL("Level::Load", path);
+	if(!io::FileExists(path))
+		return false;
+	file = new MappedFile;
+	if(!file->Open(path) || !(header = LevelFile::Validate(file->GetData(), file->GetSize())))
+	{
+		Error(Format("Level: Invalid level file '%s'.", path));
+		Unload();
+		return false;
+	}
+	byte* data = file->GetData();
+
+	// collision
+	box_count = header->boxes.count;
+	if(box_count)
+	{
+		const LevelFile::Box* boxes = (const LevelFile::Box*)(data + header->boxes.offset);
+		box_block = (byte*)btAlignedAlloc((BOX_SHAPE_SIZE + BOX_OBJECT_SIZE) * box_count, 16);
+		for(uint i = 0; i < box_count; ++i)
+		{
+			const LevelFile::Box& box = boxes[i];
+			btBoxShape* shape = new(GetBoxShape(i)) btBoxShape(btVector3(box.half_extents.x, box.half_extents.y, box.half_extents.z));
+			btCollisionObject* cobj = new(GetBoxObject(i)) btCollisionObject;
+			btTransform transform;
+			transform.setIdentity();
+			transform.setOrigin(btVector3(box.pos.x, box.pos.y, box.pos.z));
+			cobj->setCollisionShape(shape);
+			cobj->setCollisionFlags(btCollisionObject::CF_STATIC_OBJECT);
+			cobj->setWorldTransform(transform);
+			world->addCollisionObject(cobj, CG_LEVEL);
+		}
+		floor = GetBoxObject(0);
+		floor_extents = btVector3(boxes[0].half_extents.x, boxes[0].half_extents.y, boxes[0].half_extents.z);
+	}
+	if(header->collision.count)
+	{
+		baked = new BakedCollision;
+		if(!baked->Map(data + header->collision.offset, header->collision.count))
+		{
+			Error(Format("Level: Invalid collision in level file '%s'.", path));
+			Unload();
+			return false;
+		}
+		btTransform transform;
+		transform.setIdentity();
+		AddObject(baked->GetShape(), transform);
+	}
+
+	if(!scene)
+		return true;
+
+	// scene
+	scene->ambient_color = header->ambient_color;
+	scene->clear_color = header->clear_color;
+	scene->fog_color = header->fog_color;
+	scene->fog_range = header->fog_range;
+
+	const LevelFile::Node* file_nodes = (const LevelFile::Node*)(data + header->nodes.offset);
+	// mesh nodes aren't added to scene, only visible ones are added after frustum culling;
+	// meshes are loaded by caller (see GetNodeMesh), until then node have no mesh
+	nodes.resize(header->nodes.count);
+	for(uint i = 0; i < header->nodes.count; ++i)
+	{
+		SceneNode* node = SceneNode::Get();
+		node->pos = file_nodes[i].pos;
+		node->rot = file_nodes[i].rot;
+		node->mesh = nullptr;
+		node->mesh_inst = nullptr;
+		nodes[i] = node;
+	}
+
+	const LevelFile::Light* file_lights = (const LevelFile::Light*)(data + header->lights.offset);
+	lights.resize(header->lights.count);
+	for(uint i = 0; i < header->lights.count; ++i)
+	{
+		SceneNode* light = SceneNode::Get();
+		light->pos = file_lights[i].pos;
+		light->tint = file_lights[i].tint;
+		light->SetLight(file_lights[i].range);
+		scene->Add(light);
+		lights[i] = light;
+	}
+	return true;
+}
+
+cstring Level::GetNodeMesh(uint index) const
+{
+	cstring strings = (cstring)(file->GetData() + header->strings.offset);
+	const LevelFile::Node* file_nodes = (const LevelFile::Node*)(file->GetData() + header->nodes.offset);
+	return strings + file_nodes[index].mesh;
+}
+
+SceneNode* Level::FindNode(cstring mesh)
+{
+	cstring strings = (cstring)(file->GetData() + header->strings.offset);
+	const LevelFile::Node* file_nodes = (const LevelFile::Node*)(file->GetData() + header->nodes.offset);
+	for(uint i = 0; i < (uint)nodes.size(); ++i)
+	{
+		if(strcmp(strings + file_nodes[i].mesh, mesh) == 0)
+			return nodes[i];
+	}
+	return nullptr;
+}
+
+float Level::GetLightRange(uint index) const
+{
+	const LevelFile::Light* file_lights = (const LevelFile::Light*)(file->GetData() + header->lights.offset);
+	return file_lights[index].range;
+}
+
+btCollisionObject* Level::AddBox(const btVector3& half_extents, const btTransform& transform)
+{
+	btBoxShape* shape = new btBoxShape(half_extents);
+	shapes.push_back(shape);
+	return AddObject(shape, transform);
+}
+
+btCollisionObject* Level::AddBox(const btVector3& half_extents, const btVector3& pos)
+{
+	btTransform transform;
+	transform.setIdentity();
+	transform.setOrigin(pos);
+	return AddBox(half_extents, transform);
+}
+
+// heights of (width+1) x (length+1) samples, row by row along x
+Terrain* Level::AddTerrain(uint width, uint length, float cell_size, const float* heights)
+{
+	Terrain* terrain = new Terrain(width, length, cell_size, heights);
+	terrains.push_back(terrain);
+	btCollisionObject* cobj = AddObject(terrain->GetShape(), terrain->GetTransform());
+	cobj->setUserPointer(terrain);
+	return terrain;
+}
+
+btCollisionObject* Level::AddObject(btCollisionShape* shape, const btTransform& transform)
+{
+	btCollisionObject* cobj = new btCollisionObject;
+	cobj->setCollisionShape(shape);
+	cobj->setCollisionFlags(btCollisionObject::CF_STATIC_OBJECT);
+	cobj->setWorldTransform(transform);
+	world->addCollisionObject(cobj, CG_LEVEL);
+	objects.push_back(cobj);
+	return cobj;
+}
+
+btBoxShape* Level::GetBoxShape(uint index)
+{
+	return (btBoxShape*)(box_block + BOX_SHAPE_SIZE * index);
+}
+
+btCollisionObject* Level::GetBoxObject(uint index)
+{
+	return (btCollisionObject*)(box_block + BOX_SHAPE_SIZE * box_count + BOX_OBJECT_SIZE * index);
+}
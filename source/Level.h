@@ -0,0 +1,45 @@
+#pragma once
+
+#include <btBulletCollisionCommon.h>
+#include "LevelFile.h"
+
+// Static level collision, can be created in engine physics world or in headless world.
+// Loaded level file stays mapped, its collision and scene nodes use file data in place.
+class Level
+{
+public:
+	explicit Level(btCollisionWorld* world);
+	~Level();
+	void CreateCollision();
+	void SetFloorSize(float half_size);
+	bool Load(cstring path, Scene* scene);
+	btCollisionObject* AddBox(const btVector3& half_extents, const btTransform& transform);
+	btCollisionObject* AddBox(const btVector3& half_extents, const btVector3& pos);
+	Terrain* AddTerrain(uint width, uint length, float cell_size, const float* heights);
+	uint GetNodeCount() const { return (uint)nodes.size(); }
+	SceneNode* GetNode(uint index) { return nodes[index]; }
+	cstring GetNodeMesh(uint index) const;
+	SceneNode* FindNode(cstring mesh);
+	uint GetLightCount() const { return (uint)lights.size(); }
+	SceneNode* GetLight(uint index) { return lights[index]; }
+	float GetLightRange(uint index) const;
+
+private:
+	void Unload();
+	btCollisionObject* AddObject(btCollisionShape* shape, const btTransform& transform);
+	btBoxShape* GetBoxShape(uint index);
+	btCollisionObject* GetBoxObject(uint index);
+
+	btCollisionWorld* world;
+	vector<btCollisionShape*> shapes;
+	vector<btCollisionObject*> objects;
+	vector<Terrain*> terrains;
+	MappedFile* file;
+	const LevelFile::Header* header;
+	BakedCollision* baked;
+	byte* box_block; // box shapes & objects from level file, allocated at once
+	uint box_count;
+	btCollisionObject* floor; // first box
+	btVector3 floor_extents;
+	vector<SceneNode*> nodes, lights;
+};
@@ -0,0 +1,169 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "LevelFile.h"
+#include "BakedCollision.h"
+#include "CmdLine.h"
+#include <File.h>
+#include <Mesh.h>
+#include <fstream>
+
+namespace
+{
+	const char MAGIC[4] = { 'C', 'A', 'L', 'V' };
+
+	struct BakeNode
+	{
+		cstring mesh;
+		Vec3 pos;
+		bool collision; // include mesh triangles in baked collision
+	};
+
+	// test level, same as default level created in Game
+	const BakeNode bake_nodes[] = {
+		{ "floor.qmsh", Vec3(0, 0, 0), false },
+		{ "tarcza_strzelnicza.qmsh", Vec3(-2, 0, 0), true },
+		{ "intensiv.qmsh", Vec3(-1, 0, 2), true },
+		{ "skrzynka.qmsh", Vec3(0, 0, 0), false } // spins in game, can't be static collision
+	};
+	const Vec4 bake_lights[] = { Vec4(1, 0, 0, 1), Vec4(0, 1, 0, 1), Vec4(0, 0, 1, 1) };
+
+	bool InRange(const LevelFile::Section& section, uint element_size, uint size)
+	{
+		return section.offset <= size && uint64(section.count) * element_size <= size - section.offset;
+	}
+
+	uint Align16(uint offset)
+	{
+		return (offset + 15) & ~15u;
+	}
+
+	template<typename T>
+	void WriteArray(std::ostream& file, const vector<T>& items)
+	{
+		if(!items.empty())
+			file.write((const char*)items.data(), sizeof(T) * items.size());
+	}
+}
+
+// check header and that all sections are inside file
+const LevelFile::Header* LevelFile::Validate(const byte* data, uint size)
+{
+	if(!data || size < sizeof(Header))
+		return nullptr;
+	const Header* header = (const Header*)data;
+	if(memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION)
+		return nullptr;
+	if(!InRange(header->nodes, sizeof(Node), size) || !InRange(header->lights, sizeof(Light), size) || !InRange(header->boxes, sizeof(Box), size)
+		|| !InRange(header->strings, 1, size) || !InRange(header->collision, 1, size) || header->collision.offset % 16 != 0)
+		return nullptr;
+	if(header->strings.count == 0 || data[header->strings.offset + header->strings.count - 1] != 0)
+		return nullptr;
+	const Node* nodes = (const Node*)(data + header->nodes.offset);
+	for(uint i = 0; i < header->nodes.count; ++i)
+	{
+		if(nodes[i].mesh >= header->strings.count)
+			return nullptr;
+	}
+	return header;
+}
+
+// bake level file from meshes: -bake [-out path]
+int LevelFile::Bake(const CmdLine& cmd)
+{
+	Logger::SetInstance(new ConsoleLogger);
+
+	cstring out = cmd.Get("out", LEVEL_PATH);
+	vector<Node> nodes;
+	vector<Light> lights;
+	vector<Box> boxes;
+	string strings;
+	BakedCollision baked;
+	for(const BakeNode& bake_node : bake_nodes)
+	{
+		Node node;
+		node.mesh = (uint)strings.size();
+		node.pos = bake_node.pos;
+		node.rot = Vec3::Zero;
+		strings += bake_node.mesh;
+		strings += '\0';
+		nodes.push_back(node);
+		if(!bake_node.collision)
+			continue;
+
+		cstring path = Format("data/%s", bake_node.mesh);
+		FileReader f(path);
+		if(!f)
+		{
+			Error(Format("Bake: Failed to open mesh '%s'.", path));
+			return 1;
+		}
+		try
+		{
+			VertexData* vd = Mesh::LoadVertexData(f);
+			baked.AddMesh(*vd, Matrix::RotationY(node.rot.y) * Matrix::Translation(node.pos));
+			delete vd;
+		}
+		catch(cstring err)
+		{
+			Error(Format("Bake: Failed to load mesh '%s': %s", path, err));
+			return 1;
+		}
+	}
+	for(const Vec4& tint : bake_lights)
+	{
+		Light light;
+		light.pos = Vec3::Zero;
+		light.tint = tint;
+		light.range = 5;
+		lights.push_back(light);
+	}
+	Box floor;
+	floor.half_extents = Vec3(8, 0.01f, 8);
+	floor.pos = Vec3(0, -0.005f, 0);
+	boxes.push_back(floor);
+	baked.Build();
+
+	Header header;
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.ambient_color = Color(0.4f, 0.4f, 0.4f);
+	header.clear_color = Color(0.1f, 0.1f, 0.1f);
+	header.fog_color = Color(0.1f, 0.1f, 0.1f);
+	header.fog_range = Vec2(5, 10);
+	header.nodes.offset = sizeof(Header);
+	header.nodes.count = (uint)nodes.size();
+	header.lights.offset = header.nodes.offset + sizeof(Node) * header.nodes.count;
+	header.lights.count = (uint)lights.size();
+	header.boxes.offset = header.lights.offset + sizeof(Light) * header.lights.count;
+	header.boxes.count = (uint)boxes.size();
+	header.strings.offset = header.boxes.offset + sizeof(Box) * header.boxes.count;
+	header.strings.count = (uint)strings.size();
+	header.collision.offset = Align16(header.strings.offset + header.strings.count);
+
+	std::ofstream file(out, std::ios::binary);
+	if(!file)
+	{
+		Error(Format("Bake: Failed to open '%s'.", out));
+		return 1;
+	}
+	const char padding[16] = {};
+	file.write((const char*)&header, sizeof(header));
+	WriteArray(file, nodes);
+	WriteArray(file, lights);
+	WriteArray(file, boxes);
+	file.write(strings.data(), strings.size());
+	file.write(padding, header.collision.offset - header.strings.offset - header.strings.count);
+	baked.Write(file);
+
+	// size of collision section is known after writing
+	header.collision.count = (uint)file.tellp() - header.collision.offset;
+	file.seekp(0);
+	file.write((const char*)&header, sizeof(header));
+	if(!file)
+	{
+		Error(Format("Bake: Failed to write '%s'.", out));
+		return 1;
+	}
+	Info(Format("Bake: Saved '%s', %u nodes, %u triangles.", out, header.nodes.count, baked.GetTriangleCount()));
+	return 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// default path of baked level
+const cstring LEVEL_PATH = "data/level.bin";
+
+// Baked level file layout. All data is in flat arrays addressed by offset from file start, so file can be
+// mapped and used in place without parsing. Strings are offsets into string table.
+struct LevelFile
+{
+	static const uint VERSION = 1;
+
+	struct Section
+	{
+		uint offset, count;
+	};
+
+	struct Header
+	{
+		char magic[4];
+		uint version;
+		Color ambient_color, clear_color, fog_color;
+		Vec2 fog_range;
+		Section nodes, lights, boxes;
+		Section strings, collision; // count is size in bytes, collision offset is aligned to 16
+	};
+
+	struct Node
+	{
+		uint mesh;
+		Vec3 pos, rot;
+	};
+
+	struct Light
+	{
+		Vec3 pos;
+		Vec4 tint;
+		float range;
+	};
+
+	// first box is level floor
+	struct Box
+	{
+		Vec3 half_extents, pos;
+	};
+
+	static const Header* Validate(const byte* data, uint size);
+	static int Bake(const CmdLine& cmd);
+};
@@ -0,0 +1,208 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "LightClusters.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+LightClusters::LightClusters(uint size_x, uint size_y, uint size_z) : size_x(size_x), size_y(size_y), size_z(size_z)
+{
+	const uint count = size_x * size_y * size_z;
+	boxes.resize(count);
+	clusters.resize(count);
+	slices.resize(size_z);
+}
+
+// cluster bounds only depend on projection, light positions are moved to view space in Build
+void LightClusters::SetCamera(const Vec3& from, const Vec3& to, const Vec3& camera_up, float fov, float aspect, float znear, float zfar)
+{
+	this->from = from;
+	forward = (to - from).Normalized();
+	right = camera_up.Cross(forward).Normalized();
+	up = forward.Cross(right);
+
+	const float tan_y = tan(fov / 2), tan_x = tan_y * aspect;
+	for(uint z = 0; z < size_z; ++z)
+	{
+		// exponential slices, near slices are thin like objects on screen
+		const float d0 = znear * pow(zfar / znear, float(z) / size_z);
+		const float d1 = znear * pow(zfar / znear, float(z + 1) / size_z);
+		for(uint y = 0; y < size_y; ++y)
+		{
+			const float y0 = (2.f * y / size_y - 1.f) * tan_y, y1 = (2.f * (y + 1) / size_y - 1.f) * tan_y;
+			for(uint x = 0; x < size_x; ++x)
+			{
+				const float x0 = (2.f * x / size_x - 1.f) * tan_x, x1 = (2.f * (x + 1) / size_x - 1.f) * tan_x;
+				Box& box = boxes[GetIndex(x, y, z)];
+				box.v1 = Vec3(Min(x0 * d0, x0 * d1), Min(y0 * d0, y0 * d1), d0);
+				box.v2 = Vec3(Max(x1 * d0, x1 * d1), Max(y1 * d0, y1 * d1), d1);
+			}
+		}
+	}
+}
+
+void LightClusters::Build(const vector<Light>& lights, ThreadPool* pool)
+{
+	TRACE_ZONE("LightClusters::Build");
+	TransformLights(lights);
+
+	if(pool)
+		pool->ParallelFor(size_z, [this](uint z) { BinSlice(z); });
+	else
+	{
+		for(uint z = 0; z < size_z; ++z)
+			BinSlice(z);
+	}
+
+	uint offset = 0;
+	for(Slice& slice : slices)
+	{
+		slice.offset = offset;
+		offset += (uint)slice.sorted.size();
+	}
+	light_indices.resize(offset);
+
+	if(pool)
+		pool->ParallelFor(size_z, [this](uint z) { JoinSlice(z); });
+	else
+	{
+		for(uint z = 0; z < size_z; ++z)
+			JoinSlice(z);
+	}
+}
+
+void LightClusters::BuildReference(const vector<Light>& lights)
+{
+	TransformLights(lights);
+	light_indices.clear();
+	for(uint i = 0; i < (uint)clusters.size(); ++i)
+	{
+		Cluster& cluster = clusters[i];
+		cluster.offset = (uint)light_indices.size();
+		for(uint j = 0; j < (uint)view_lights.size(); ++j)
+		{
+			if(Intersects(view_lights[j], boxes[i]))
+				light_indices.push_back(j);
+		}
+		cluster.count = (uint)light_indices.size() - cluster.offset;
+	}
+}
+
+void LightClusters::TransformLights(const vector<Light>& lights)
+{
+	view_lights.resize(lights.size());
+	for(uint i = 0; i < (uint)lights.size(); ++i)
+	{
+		const Vec3 dir = lights[i].pos - from;
+		view_lights[i].pos = Vec3(dir.Dot(right), dir.Dot(up), dir.Dot(forward));
+		view_lights[i].range = lights[i].range;
+	}
+}
+
+void LightClusters::BinSlice(uint z)
+{
+	Slice& slice = slices[z];
+	const uint tiles = size_x * size_y;
+	slice.items.clear();
+	slice.counts.assign(tiles, 0);
+
+	const Box& first = boxes[GetIndex(0, 0, z)];
+	for(uint i = 0; i < (uint)view_lights.size(); ++i)
+	{
+		const Light& light = view_lights[i];
+		const Vec3& pos = light.pos;
+		const float r = light.range;
+		if(pos.z + r < first.v1.z || pos.z - r > first.v2.z)
+			continue;
+
+		// tile bounds grow with index, only tiles overlapping light bounding box are tested
+		uint x0 = 0, y0 = 0;
+		while(x0 < size_x && boxes[GetIndex(x0, 0, z)].v2.x < pos.x - r)
+			++x0;
+		uint x1 = x0;
+		while(x1 < size_x && boxes[GetIndex(x1, 0, z)].v1.x <= pos.x + r)
+			++x1;
+		while(y0 < size_y && boxes[GetIndex(0, y0, z)].v2.y < pos.y - r)
+			++y0;
+		uint y1 = y0;
+		while(y1 < size_y && boxes[GetIndex(0, y1, z)].v1.y <= pos.y + r)
+			++y1;
+
+		for(uint y = y0; y < y1; ++y)
+		{
+			for(uint x = x0; x < x1; ++x)
+			{
+				if(Intersects(light, boxes[GetIndex(x, y, z)]))
+				{
+					const uint tile = x + y * size_x;
+					slice.items.push_back(std::make_pair(tile, i));
+					++slice.counts[tile];
+				}
+			}
+		}
+	}
+
+	// counting sort by tile, lights stay in index order
+	slice.offsets.resize(tiles);
+	uint offset = 0;
+	for(uint i = 0; i < tiles; ++i)
+	{
+		slice.offsets[i] = offset;
+		offset += slice.counts[i];
+	}
+	slice.sorted.resize(slice.items.size());
+	for(const std::pair<uint, uint>& item : slice.items)
+		slice.sorted[slice.offsets[item.first]++] = item.second;
+	for(uint i = 0; i < tiles; ++i)
+		slice.offsets[i] -= slice.counts[i];
+}
+
+void LightClusters::JoinSlice(uint z)
+{
+	const Slice& slice = slices[z];
+	const uint tiles = size_x * size_y;
+	for(uint i = 0; i < tiles; ++i)
+	{
+		Cluster& cluster = clusters[z * tiles + i];
+		cluster.offset = slice.offset + slice.offsets[i];
+		cluster.count = slice.counts[i];
+	}
+	std::copy(slice.sorted.begin(), slice.sorted.end(), light_indices.begin() + slice.offset);
+}
+
+bool LightClusters::Intersects(const Light& light, const Box& box) const
+{
+	const Vec3& pos = light.pos;
+	float dist = 0.f;
+	if(pos.x < box.v1.x)
+		dist += (box.v1.x - pos.x) * (box.v1.x - pos.x);
+	else if(pos.x > box.v2.x)
+		dist += (pos.x - box.v2.x) * (pos.x - box.v2.x);
+	if(pos.y < box.v1.y)
+		dist += (box.v1.y - pos.y) * (box.v1.y - pos.y);
+	else if(pos.y > box.v2.y)
+		dist += (pos.y - box.v2.y) * (pos.y - box.v2.y);
+	if(pos.z < box.v1.z)
+		dist += (box.v1.z - pos.z) * (box.v1.z - pos.z);
+	else if(pos.z > box.v2.z)
+		dist += (pos.z - box.v2.z) * (pos.z - box.v2.z);
+	return dist <= light.range * light.range;
+}
+
+uint LightClusters::GetUsedClusterCount() const
+{
+	uint count = 0;
+	for(const Cluster& cluster : clusters)
+	{
+		if(cluster.count)
+			++count;
+	}
+	return count;
+}
+
+uint LightClusters::GetMaxLightsPerCluster() const
+{
+	uint max_count = 0;
+	for(const Cluster& cluster : clusters)
+		max_count = Max(max_count, cluster.count);
+	return max_count;
+}
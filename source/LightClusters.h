@@ -0,0 +1,52 @@
+#pragma once
+
+// Clustered light assignment. View frustum is split into size_x * size_y screen tiles and size_z exponential depth slices,
+// each point light is added to every cluster its sphere touches. Result is compact list of light indices for each cluster.
+// Slices are binned in parallel into own buffers and joined in slice order, so result is same for any thread count.
+// Works in view space (x right, y up, z forward), doesn't need render so can be tested headless.
+class LightClusters
+{
+public:
+	struct Light
+	{
+		Vec3 pos;
+		float range;
+	};
+
+	struct Cluster
+	{
+		uint offset, count; // range in light indices
+	};
+
+	LightClusters(uint size_x, uint size_y, uint size_z);
+	void SetCamera(const Vec3& from, const Vec3& to, const Vec3& up, float fov, float aspect, float znear, float zfar);
+	void Build(const vector<Light>& lights, ThreadPool* pool);
+	void BuildReference(const vector<Light>& lights); // tests every light against every cluster, for verification
+	uint GetIndex(uint x, uint y, uint z) const { return x + (y + z * size_y) * size_x; }
+	uint GetClusterCount() const { return (uint)clusters.size(); }
+	const Cluster& GetCluster(uint index) const { return clusters[index]; }
+	const vector<uint>& GetLightIndices() const { return light_indices; }
+	uint GetUsedClusterCount() const;
+	uint GetMaxLightsPerCluster() const;
+
+private:
+	struct Slice
+	{
+		vector<std::pair<uint, uint>> items; // (cluster in slice, light)
+		vector<uint> counts, offsets, sorted;
+		uint offset; // in light_indices
+	};
+
+	void TransformLights(const vector<Light>& lights);
+	void BinSlice(uint z);
+	void JoinSlice(uint z);
+	bool Intersects(const Light& light, const Box& box) const;
+
+	uint size_x, size_y, size_z;
+	Vec3 from, right, up, forward;
+	vector<Box> boxes; // view space bounds of each cluster
+	vector<Light> view_lights;
+	vector<Slice> slices;
+	vector<Cluster> clusters;
+	vector<uint> light_indices;
+};
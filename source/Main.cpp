@@ -2,10 +2,34 @@
 #include "GameCore.h"
 #include <AppEntry.h>
 #include "Game.h"
+#include "Benchmark.h"
+#include "CmdLine.h"
+#include "LevelFile.h"
+#include "Simulation.h"
+#include "Trace.h"
 
+// Headless modes (-headless, -replay, -stress, -rollback, -replicate, -bench, -bake) run from game executable without
+// creating Engine. It links carpglib so it is built only for Windows by caadv.vcxproj, there is no separate headless target.
 int AppEntry(char* cmd_line)
 {
+	CmdLine cmd(cmd_line);
+	if(cmd.Has("headless") || cmd.Has("replay") || cmd.Has("stress") || cmd.Has("rollback") || cmd.Has("replicate"))
+		return Simulation::Main(cmd);
+	if(cmd.Has("bench"))
+		return Benchmark::Main(cmd);
+	if(cmd.Has("bake"))
+		return LevelFile::Bake(cmd);
+
 	Game game;
+	if(cstring path = cmd.Get("record"))
+		game.record_path = path;
+	if(cmd.Has("target_fps"))
+		game.target_frame_time = 1.f / Max(cmd.GetFloat("target_fps", 60.f), 1.f);
+	if(cmd.Has("trace"))
+	{
+		Trace::Enable(true);
+		game.trace_startup = true;
+	}
 	game.Run();
 	return 0;
 }
@@ -0,0 +1,21 @@
+#pragma once
+
+// Whole file mapped to memory as copy on write. Pages are shared between processes mapping same file
+// until written, writes are private and never reach the file.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	bool Open(cstring path);
+	void Close();
+	byte* GetData() { return data; }
+	uint GetSize() const { return size; }
+
+private:
+	byte* data;
+	uint size;
+#ifdef _WIN32
+	void* file, *mapping;
+#endif
+};
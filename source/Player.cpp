@@ -1,54 +1,82 @@
 #include "Pch.h"
 #include "GameCore.h"
 #include "Player.h"
+#include "AnimationMachine.h"
 #include <SceneNode.h>
 #include <MeshInstance.h>
-#include <ResourceManager.h>
 #include <Input.h>
 #include "Game.h"
 #include "GameCamera.h"
 #include "CharacterController.h"
+#include "CharacterControllerSystem.h"
+#include "Trace.h"
 
 const float RADIUS = 0.3f;
 const float HEIGHT = 1.75f;
 
-Player::Player() : anim(ANI_STAND), rot_buf(0.f)
+PlayerInput PlayerInput::FromKeyboard()
 {
-	node = SceneNode::Get();
-	node->pos = Vec3(0, 0, -2);
-	node->rot = Vec3(0, PI, 0);
-	node->SetMesh(new MeshInstance(app::res_mgr->Load<Mesh>("human.qmsh")));
-	node->mesh_inst->Play("stoi", 0);
+	PlayerInput input;
+	input.rot = Clip(-game->camera->rot.x - PI / 2);
+	input.dir = 0;
+	if(app::input->Down(Key::W) || app::input->Down(Key::Up))
+		input.dir += 10;
+	if(app::input->Down(Key::S) || app::input->Down(Key::Down))
+		input.dir -= 10;
+	if(app::input->Down(Key::A) || app::input->Down(Key::Left))
+		input.dir -= 1;
+	if(app::input->Down(Key::D) || app::input->Down(Key::Right))
+		input.dir += 1;
+	input.walk = app::input->Down(Key::Shift);
+	input.jump = app::input->Pressed(Key::Spacebar);
+	return input;
+}
+
+Player::Player(CharacterControllerSystem* controllers, const AnimationMachine* anim_machine, bool headless) : controllers(controllers), pos(0, 0, -2), prev_pos(pos),
+	rot(PI), prev_rot(rot), anim_machine(anim_machine), anim(0), rot_buf(0.f), required_rot(0.f)
+{
+	TRACE_ZONE("Player::Player");
+	if(headless)
+		node = nullptr;
+	else
+	{
+		node = SceneNode::Get();
+		node->pos = pos;
+		node->rot = Vec3(0, rot, 0);
+		node->mesh = nullptr;
+		node->mesh_inst = nullptr;
+	}
 
-	controller = new CharacterController(RADIUS, HEIGHT);
+	controller = controllers->Add(RADIUS, HEIGHT);
 }
 
 Player::~Player()
 {
-	delete controller;
+	controllers->Remove(controller);
 }
 
-void Player::Update(float dt)
+void Player::Update(float dt, const PlayerInput& input)
 {
-	if(controller->canJump() && app::input->Pressed(Key::Spacebar))
-		controller->jump();
+	TRACE_ZONE("Player::Update");
+	prev_pos = pos;
+	prev_rot = rot;
 
-	Animation new_anim = ANI_STAND;
+	if(controller->canJump() && input.jump)
+		controller->jump();
 
 	const float rot_speed = 5.f;
 	const float walk_speed = 2.5f;
-	const float anim_run_speed = 4.f;
 	const float run_speed = 8.f;
 
-	float required_rot = Clip(-game->camera->rot.x - PI / 2);
-	float rot_dif = AngleDiff(node->rot.y, required_rot);
+	required_rot = input.rot;
+	float rot_dif = AngleDiff(rot, required_rot);
 	if(NotZero(rot_dif))
 	{
-		float best_rot = ShortestArc(node->rot.y, required_rot);
+		float best_rot = ShortestArc(rot, required_rot);
 		if(rot_dif <= rot_speed * dt)
-			node->rot.y = required_rot;
+			rot = required_rot;
 		else
-			node->rot.y = Clip(node->rot.y + best_rot * rot_speed * dt);
+			rot = Clip(rot + best_rot * rot_speed * dt);
 		if(best_rot > 0.f)
 			rot_buf = 0.1f;
 		else
@@ -57,28 +85,18 @@ void Player::Update(float dt)
 
 	if(rot_buf > 0.f)
 	{
-		new_anim = ANI_ROTATE_RIGHT;
 		rot_buf -= dt;
 		if(rot_buf <= 0.f)
 			rot_buf = 0;
 	}
 	else if(rot_buf < 0.f)
 	{
-		new_anim = ANI_ROTATE_LEFT;
 		rot_buf += dt;
 		if(rot_buf >= 0.f)
 			rot_buf = 0;
 	}
 
-	int dir = 0;
-	if(app::input->Down(Key::W) || app::input->Down(Key::Up))
-		dir += 10;
-	if(app::input->Down(Key::S) || app::input->Down(Key::Down))
-		dir -= 10;
-	if(app::input->Down(Key::A) || app::input->Down(Key::Left))
-		dir -= 1;
-	if(app::input->Down(Key::D) || app::input->Down(Key::Right))
-		dir += 1;
+	const int dir = input.dir;
 	if(dir == 0)
 	{
 		controller->setLinearDamping(10.f);
@@ -89,7 +107,7 @@ void Player::Update(float dt)
 		bool run;
 		//bool prevent_fall;
 		float speed;
-		if(app::input->Down(Key::Shift) || dir <= -9)
+		if(input.walk || dir <= -9)
 		{
 			speed = walk_speed;
 			//prevent_fall = true;
@@ -136,55 +154,77 @@ void Player::Update(float dt)
 		controller->setWalkDirection(btVector3(cos(dir_rot) * speed, 0, sin(dir_rot) * speed));
 		//controller->setPreventFall(prevent_fall);
 	}
+}
 
-	controller->update(dt);
-
-	const btVector3& velocity = controller->getVelocity();
-	float velocity_speed = velocity.length();
-	if(velocity_speed >= anim_run_speed)
-		new_anim = ANI_RUN;
-	else if(velocity_speed >= 0.5f)
-	{
-		float v_dir = Angle(0, 0, velocity.x(), velocity.z());
-		if(AngleDiff(required_rot, v_dir) <= PI / 2)
-			new_anim = ANI_WALK;
-		else
-			new_anim = ANI_WALK_BACK;
-	}
-
-	btVector3 pos = controller->getPos();
-	node->pos = Vec3(pos.getX(), pos.getY() - HEIGHT / 2, pos.getZ());
+// called after CharacterControllerSystem::Update
+void Player::PostUpdate()
+{
+	const btVector3& controller_pos = controller->getPos();
+	pos = Vec3(controller_pos.getX(), controller_pos.getY() - HEIGHT / 2, controller_pos.getZ());
 
-	if(node->pos.y < -5.f)
+	if(pos.y < -5.f)
 	{
-		node->pos = Vec3::Zero;
+		pos = Vec3::Zero;
+		prev_pos = pos;
 		controller->reset();
-		controller->getObject()->getWorldTransform().getOrigin().setValue(0, HEIGHT / 2, 0);
+		controller->warp(btVector3(0, HEIGHT / 2, 0));
 	}
 
+	const btVector3& velocity = controller->getVelocity();
+	float params[AnimationMachine::P_MAX];
+	params[AnimationMachine::P_SPEED] = velocity.length();
+	params[AnimationMachine::P_MOVE_ANGLE] = params[AnimationMachine::P_SPEED] > 0.f ? AngleDiff(required_rot, Angle(0, 0, velocity.x(), velocity.z())) : 0.f;
+	params[AnimationMachine::P_ROTATE] = rot_buf > 0.f ? 1.f : (rot_buf < 0.f ? -1.f : 0.f);
+	const int new_anim = anim_machine->Evaluate(anim, params);
 	if(new_anim != anim)
 	{
-		switch(new_anim)
-		{
-		case ANI_STAND:
-			node->mesh_inst->Play("stoi", 0, 0);
-			break;
-		case ANI_WALK:
-			node->mesh_inst->Play("idzie", 0, 0);
-			break;
-		case ANI_WALK_BACK:
-			node->mesh_inst->Play("idzie", PLAY_BACK, 0);
-			break;
-		case ANI_RUN:
-			node->mesh_inst->Play("biegnie", 0, 0);
-			break;
-		case ANI_ROTATE_LEFT:
-			node->mesh_inst->Play("w_lewo", 0, 0);
-			break;
-		case ANI_ROTATE_RIGHT:
-			node->mesh_inst->Play("w_prawo", 0, 0);
-			break;
-		}
+		if(node && node->mesh_inst)
+			anim_machine->Play(node->mesh_inst, new_anim);
 		anim = new_anim;
 	}
 }
+
+// called when node mesh instance is created, animation machine must be already loaded for it
+void Player::StartAnimation()
+{
+	anim_machine->Play(node->mesh_inst, anim);
+}
+
+void Player::SaveSnapshot(Snapshot& s) const
+{
+	controller->saveSnapshot(s.controller);
+	s.pos = pos;
+	s.prev_pos = prev_pos;
+	s.rot = rot;
+	s.prev_rot = prev_rot;
+	s.rot_buf = rot_buf;
+	s.required_rot = required_rot;
+}
+
+void Player::LoadSnapshot(const Snapshot& s)
+{
+	controller->loadSnapshot(s.controller);
+	pos = s.pos;
+	prev_pos = s.prev_pos;
+	rot = s.rot;
+	prev_rot = s.prev_rot;
+	rot_buf = s.rot_buf;
+	required_rot = s.required_rot;
+}
+
+// teleport without interpolation, pos is at feet
+void Player::Warp(const Vec3& new_pos)
+{
+	pos = new_pos;
+	prev_pos = new_pos;
+	controller->warp(btVector3(pos.x, pos.y + HEIGHT / 2, pos.z));
+}
+
+// set node transform between previous and current tick, t in [0,1)
+void Player::Interpolate(float t)
+{
+	if(!node)
+		return;
+	node->pos = Vec3::Lerp(prev_pos, pos, t);
+	node->rot.y = Clip(prev_rot + ShortestArc(prev_rot, rot) * t);
+}
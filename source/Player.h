@@ -1,23 +1,45 @@
 #pragma once
 
+#include "CharacterController.h"
+
+// movement intent for single tick, read from keyboard, replay, script or AiBrain
+struct PlayerInput
+{
+	float rot; // required rotation
+	int dir; // sum of: 10 forward, -10 backward, -1 left, 1 right
+	bool walk, jump;
+
+	static PlayerInput FromKeyboard();
+};
+
 struct Player
 {
-	enum Animation
+	// simulation state of player & its controller for rollback, plain data
+	// animation state isn't included, it doesn't affect movement and keeps playing through resimulation
+	struct Snapshot
 	{
-		ANI_STAND,
-		ANI_WALK,
-		ANI_WALK_BACK,
-		ANI_RUN,
-		ANI_ROTATE_LEFT,
-		ANI_ROTATE_RIGHT
+		CharacterController::Snapshot controller;
+		Vec3 pos, prev_pos;
+		float rot, prev_rot, rot_buf, required_rot;
 	};
 
-	Player();
+	// animation state is evaluated in headless mode too, node is created only when not headless (without mesh until StartAnimation)
+	Player(CharacterControllerSystem* controllers, const AnimationMachine* anim_machine, bool headless);
 	~Player();
-	void Update(float dt);
+	void Update(float dt, const PlayerInput& input);
+	void PostUpdate();
+	void Interpolate(float t);
+	void Warp(const Vec3& new_pos);
+	void StartAnimation();
+	void SaveSnapshot(Snapshot& s) const;
+	void LoadSnapshot(const Snapshot& s);
 
-	SceneNode* node;
+	SceneNode* node; // nullptr in headless mode
+	CharacterControllerSystem* controllers;
 	CharacterController* controller;
-	Animation anim;
-	float rot_buf;
+	Vec3 pos, prev_pos; // simulated position in last two ticks
+	float rot, prev_rot;
+	const AnimationMachine* anim_machine;
+	int anim; // animation machine state
+	float rot_buf, required_rot;
 };
@@ -0,0 +1,124 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "QualityGovernor.h"
+
+QualityGovernor::QualityGovernor(float target) : target(target), smoothing(0.5f), down_margin(1.1f), up_margin(0.75f), down_delay(0.5f),
+	up_delay(3.f), max_up_delay(60.f), fail_window(5.f), max_frame_time(0.05f), level(0), smoothed(target), smoothed_work(target), time(0), over_time(0),
+	under_time(0)
+{
+}
+
+void QualityGovernor::AddStep(cstring name, Apply apply)
+{
+	Step step;
+	step.name = name;
+	step.apply = apply;
+	step.value = nullptr;
+	step.saved = false;
+	step.up_delay = up_delay;
+	step.raise_time = -fail_window;
+	steps.push_back(step);
+}
+
+void QualityGovernor::AddSwitch(cstring name, bool& value)
+{
+	AddStep(name, nullptr);
+	steps.back().value = &value;
+}
+
+int QualityGovernor::Update(float frame_time, float work_time)
+{
+	frame_time = Min(frame_time, max_frame_time);
+	work_time = Min(work_time, frame_time);
+	time += frame_time;
+	const float factor = 1.f - exp(-frame_time / smoothing);
+	smoothed += (frame_time - smoothed) * factor;
+	smoothed_work += (work_time - smoothed_work) * factor;
+
+	if(smoothed > target * down_margin)
+	{
+		over_time += frame_time;
+		under_time = 0;
+	}
+	else if(smoothed_work < target * up_margin)
+	{
+		under_time += frame_time;
+		over_time = 0;
+	}
+	else
+	{
+		over_time = 0;
+		under_time = 0;
+	}
+
+	if(over_time >= down_delay && level < steps.size())
+	{
+		Reduce();
+		over_time = 0;
+		return -1;
+	}
+	if(level > 0 && under_time >= steps[level - 1].up_delay)
+	{
+		Raise();
+		under_time = 0;
+		return 1;
+	}
+	return 0;
+}
+
+// steps that are already off (switch disabled by user) are skipped, each change must have effect
+void QualityGovernor::Reduce()
+{
+	while(level < steps.size())
+	{
+		Step& step = steps[level++];
+		const bool effective = IsEffective(step);
+		ReduceStep(step);
+		if(time - step.raise_time < fail_window)
+			step.up_delay = Min(step.up_delay * 2, max_up_delay);
+		if(effective)
+			break;
+	}
+}
+
+void QualityGovernor::Raise()
+{
+	while(level > 0)
+	{
+		Step& step = steps[--level];
+		RestoreStep(step);
+		step.raise_time = time;
+		if(IsEffective(step))
+			break;
+	}
+}
+
+void QualityGovernor::ReduceStep(Step& step)
+{
+	if(step.value)
+	{
+		step.saved = *step.value;
+		*step.value = false;
+	}
+	else
+		step.apply(true);
+}
+
+void QualityGovernor::RestoreStep(Step& step)
+{
+	if(step.value)
+		*step.value = step.saved;
+	else
+		step.apply(false);
+}
+
+void QualityGovernor::SetLevel(uint new_level)
+{
+	new_level = Min(new_level, (uint)steps.size());
+	while(level < new_level)
+		ReduceStep(steps[level++]);
+	while(level > new_level)
+		RestoreStep(steps[--level]);
+	over_time = 0;
+	under_time = 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <functional>
+
+// Keeps frame time near target by walking ordered quality ladder: level n means first n steps are reduced.
+// Frame & work time (frame without present/vsync wait) are smoothed (exponential average with time constant), quality
+// goes down when frame time stays above target * down_margin for down_delay and up when work time stays below
+// target * up_margin for up_delay (vsync holds frame time at target even with free time). Gap between margins and
+// delays is the hysteresis. When raised step must be reduced again shortly after, its up delay is doubled, so load near
+// the edge doesn't flip same step forever. Doesn't depend on engine, can be driven by synthetic frame times.
+class QualityGovernor
+{
+public:
+	typedef std::function<void(bool reduced)> Apply;
+
+	explicit QualityGovernor(float target);
+	void AddStep(cstring name, Apply apply);
+	void AddSwitch(cstring name, bool& value); // reduced step turns value off, restores previous value when raised
+	int Update(float frame_time, float work_time); // returns -1 when quality was reduced, 1 when raised, 0 otherwise
+	void SetLevel(uint level);
+	uint GetLevel() const { return level; }
+	uint GetMaxLevel() const { return (uint)steps.size(); }
+	cstring GetStepName(uint index) const { return steps[index].name; }
+	float GetSmoothedTime() const { return smoothed; }
+	float GetSmoothedWorkTime() const { return smoothed_work; }
+
+	float target; // in seconds
+	float smoothing; // time constant of frame time average
+	float down_margin, up_margin;
+	float down_delay, up_delay, max_up_delay;
+	float fail_window; // step reduced again within this time after raise gets longer up delay
+	float max_frame_time; // longer frames (loading hitches) are clamped
+
+private:
+	struct Step
+	{
+		cstring name;
+		Apply apply;
+		bool* value;
+		bool saved;
+		float up_delay, raise_time;
+	};
+
+	bool IsEffective(const Step& step) const { return !step.value || *step.value; }
+	void Reduce();
+	void Raise();
+	void ReduceStep(Step& step);
+	void RestoreStep(Step& step);
+
+	vector<Step> steps;
+	uint level;
+	float smoothed, smoothed_work, time, over_time, under_time;
+};
@@ -0,0 +1,273 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "Replication.h"
+#include "CharacterController.h"
+#include "Player.h"
+
+namespace
+{
+	const float POS_SCALE = 256.f;
+	const float VEL_SCALE = 64.f;
+	const int YAW_STEPS = 4096;
+	// bits of absolute value, signed fields are zigzag encoded (position range is +-2048 m, velocity +-128 m/s)
+	const uint FIELD_BITS[CharacterState::F_MAX] = { 20, 20, 20, 14, 14, 14, 12, 8 };
+	const bool FIELD_SIGNED[CharacterState::F_MAX] = { true, true, true, true, true, true, false, false };
+	// delta size classes, 2 bits select one of them or absolute value
+	const uint DELTA_BITS[3] = { 4, 8, 12 };
+	const CharacterState ZERO_STATE = {};
+
+	uint ZigZag(int value)
+	{
+		return (uint(value) << 1) ^ uint(value >> 31);
+	}
+
+	int UnZigZag(uint value)
+	{
+		return int(value >> 1) ^ -int(value & 1);
+	}
+
+	int Quantize(float value, float scale, uint bits)
+	{
+		const int limit = 1 << (bits - 1);
+		return Clamp(int(floor(value * scale + 0.5f)), -limit, limit - 1);
+	}
+
+	// yaw delta wraps around, so turning past 0 is still small
+	int GetDelta(uint field, int value, int base)
+	{
+		const int delta = value - base;
+		if(field == CharacterState::F_YAW)
+			return ((delta + YAW_STEPS / 2) & (YAW_STEPS - 1)) - YAW_STEPS / 2;
+		return delta;
+	}
+
+	void WriteField(BitWriter& out, uint field, int value, int base)
+	{
+		const int delta = GetDelta(field, value, base);
+		if(delta == 0)
+		{
+			out.WriteBit(false);
+			return;
+		}
+		out.WriteBit(true);
+		const uint zz = ZigZag(delta);
+		for(uint i = 0; i < countof(DELTA_BITS); ++i)
+		{
+			if(zz < (1u << DELTA_BITS[i]))
+			{
+				out.Write(i, 2);
+				out.Write(zz, DELTA_BITS[i]);
+				return;
+			}
+		}
+		out.Write(countof(DELTA_BITS), 2);
+		out.Write(FIELD_SIGNED[field] ? ZigZag(value) : uint(value), FIELD_BITS[field]);
+	}
+
+	int ReadField(BitReader& in, uint field, int base)
+	{
+		if(!in.ReadBit())
+			return base;
+		const uint size_class = in.Read(2);
+		if(size_class == countof(DELTA_BITS))
+		{
+			const uint value = in.Read(FIELD_BITS[field]);
+			return FIELD_SIGNED[field] ? UnZigZag(value) : int(value);
+		}
+		const int delta = UnZigZag(in.Read(DELTA_BITS[size_class]));
+		if(field == CharacterState::F_YAW)
+			return (base + delta) & (YAW_STEPS - 1);
+		return base + delta;
+	}
+}
+
+//=================================================================================================
+CharacterState CharacterState::FromPlayer(const Player& player)
+{
+	const btVector3& pos = player.controller->getPos();
+	const btVector3& vel = player.controller->getVelocity();
+	CharacterState s;
+	s.values[F_POS_X] = Quantize(pos.x(), POS_SCALE, FIELD_BITS[F_POS_X]);
+	s.values[F_POS_Y] = Quantize(pos.y(), POS_SCALE, FIELD_BITS[F_POS_Y]);
+	s.values[F_POS_Z] = Quantize(pos.z(), POS_SCALE, FIELD_BITS[F_POS_Z]);
+	s.values[F_VEL_X] = Quantize(vel.x(), VEL_SCALE, FIELD_BITS[F_VEL_X]);
+	s.values[F_VEL_Y] = Quantize(vel.y(), VEL_SCALE, FIELD_BITS[F_VEL_Y]);
+	s.values[F_VEL_Z] = Quantize(vel.z(), VEL_SCALE, FIELD_BITS[F_VEL_Z]);
+	s.values[F_YAW] = int(floor(player.rot / (PI * 2) * YAW_STEPS + 0.5f)) & (YAW_STEPS - 1);
+	s.values[F_ANIM] = Clamp(player.anim, 0, (1 << FIELD_BITS[F_ANIM]) - 1);
+	return s;
+}
+
+Vec3 CharacterState::GetPos() const
+{
+	return Vec3(float(values[F_POS_X]), float(values[F_POS_Y]), float(values[F_POS_Z])) / POS_SCALE;
+}
+
+Vec3 CharacterState::GetVelocity() const
+{
+	return Vec3(float(values[F_VEL_X]), float(values[F_VEL_Y]), float(values[F_VEL_Z])) / VEL_SCALE;
+}
+
+float CharacterState::GetYaw() const
+{
+	return float(values[F_YAW]) / YAW_STEPS * PI * 2;
+}
+
+bool CharacterState::operator==(const CharacterState& s) const
+{
+	for(uint i = 0; i < F_MAX; ++i)
+	{
+		if(values[i] != s.values[i])
+			return false;
+	}
+	return true;
+}
+
+//=================================================================================================
+ReplicationSender::ReplicationSender() : acked(0), have_ack(false)
+{
+	for(Frame& frame : history)
+		frame.valid = false;
+}
+
+// packet: tick, baseline offset (if any), character count, then for each character changed bit and changed fields
+void ReplicationSender::Encode(uint tick, const vector<CharacterState>& states, BitWriter& out)
+{
+	const Frame* base = nullptr;
+	if(have_ack && acked < tick && tick - acked < HISTORY)
+	{
+		const Frame& frame = history[acked % HISTORY];
+		if(frame.valid && frame.tick == acked && frame.states.size() == states.size())
+			base = &frame;
+	}
+
+	out.Write(tick, 32);
+	out.WriteBit(base != nullptr);
+	if(base)
+		out.Write(tick - acked, 8);
+	out.Write((uint)states.size(), 16);
+	for(uint i = 0; i < (uint)states.size(); ++i)
+	{
+		const CharacterState& state = states[i];
+		const CharacterState& base_state = base ? base->states[i] : ZERO_STATE;
+		if(state == base_state)
+		{
+			out.WriteBit(false);
+			continue;
+		}
+		out.WriteBit(true);
+		for(uint j = 0; j < CharacterState::F_MAX; ++j)
+			WriteField(out, j, state.values[j], base_state.values[j]);
+	}
+	out.Flush();
+
+	Frame& frame = history[tick % HISTORY];
+	frame.tick = tick;
+	frame.valid = true;
+	frame.states = states;
+}
+
+void ReplicationSender::Ack(uint tick)
+{
+	if(!have_ack || tick > acked)
+	{
+		acked = tick;
+		have_ack = true;
+	}
+}
+
+const vector<CharacterState>* ReplicationSender::GetSent(uint tick) const
+{
+	const Frame& frame = history[tick % HISTORY];
+	if(frame.valid && frame.tick == tick)
+		return &frame.states;
+	return nullptr;
+}
+
+//=================================================================================================
+ReplicationReceiver::ReplicationReceiver() : current(nullptr), last_tick(0)
+{
+	for(Frame& frame : history)
+		frame.valid = false;
+}
+
+bool ReplicationReceiver::Decode(const byte* data, uint size)
+{
+	BitReader in(data, size);
+	const uint tick = in.Read(32);
+	// too old, its slot is used by newer tick
+	if(current && tick + ReplicationSender::HISTORY <= last_tick)
+		return false;
+
+	const Frame* base = nullptr;
+	if(in.ReadBit())
+	{
+		const uint offset = in.Read(8);
+		const uint base_tick = tick - offset;
+		const Frame& frame = history[base_tick % ReplicationSender::HISTORY];
+		if(offset == 0 || offset >= ReplicationSender::HISTORY || !frame.valid || frame.tick != base_tick)
+			return false;
+		base = &frame;
+	}
+	const uint count = in.Read(16);
+	if(in.HaveError() || (base && base->states.size() != count))
+		return false;
+
+	Frame& frame = history[tick % ReplicationSender::HISTORY];
+	frame.valid = false;
+	frame.states.resize(count);
+	for(uint i = 0; i < count; ++i)
+	{
+		const CharacterState& base_state = base ? base->states[i] : ZERO_STATE;
+		CharacterState& state = frame.states[i];
+		if(!in.ReadBit())
+		{
+			state = base_state;
+			continue;
+		}
+		for(uint j = 0; j < CharacterState::F_MAX; ++j)
+			state.values[j] = ReadField(in, j, base_state.values[j]);
+	}
+	if(in.HaveError())
+		return false;
+
+	frame.tick = tick;
+	frame.valid = true;
+	if(!current || tick > last_tick)
+	{
+		current = &frame;
+		last_tick = tick;
+	}
+	return true;
+}
+
+//=================================================================================================
+LoopbackTransport::LoopbackTransport(uint latency, float loss, uint seed) : sent_bytes(0), latency(latency), sent_count(0), lost_count(0),
+	rng(seed), loss(loss)
+{
+}
+
+void LoopbackTransport::Send(uint time, const vector<byte>& data)
+{
+	++sent_count;
+	sent_bytes += data.size();
+	rng = rng * 1664525u + 1013904223u;
+	if(float(rng >> 8) / (1 << 24) < loss)
+	{
+		++lost_count;
+		return;
+	}
+	Packet packet;
+	packet.time = time + latency;
+	packet.data = data;
+	queue.push_back(std::move(packet));
+}
+
+bool LoopbackTransport::Receive(uint time, vector<byte>& data)
+{
+	if(queue.empty() || queue.front().time > time)
+		return false;
+	data = std::move(queue.front().data);
+	queue.pop_front();
+	return true;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <deque>
+#include "BitStream.h"
+
+// Character state quantized for network: position 1/256 m, velocity 1/64 m/s, yaw 1/4096 of full turn, animation state.
+struct CharacterState
+{
+	enum Field
+	{
+		F_POS_X,
+		F_POS_Y,
+		F_POS_Z,
+		F_VEL_X,
+		F_VEL_Y,
+		F_VEL_Z,
+		F_YAW,
+		F_ANIM,
+		F_MAX
+	};
+
+	int values[F_MAX];
+
+	static CharacterState FromPlayer(const Player& player);
+	Vec3 GetPos() const;
+	Vec3 GetVelocity() const;
+	float GetYaw() const;
+	bool operator==(const CharacterState& s) const;
+	bool operator!=(const CharacterState& s) const { return !operator==(s); }
+};
+
+// Server side of one client connection. Snapshot of all characters is delta encoded against last snapshot acknowledged
+// by client (or zero state when there isn't one yet), so only changed fields are sent, small deltas with fewer bits.
+// Character list must be same on both sides (same count & order each tick).
+class ReplicationSender
+{
+public:
+	static const uint HISTORY = 32; // ticks kept as possible baselines
+
+	ReplicationSender();
+	void Encode(uint tick, const vector<CharacterState>& states, BitWriter& out);
+	void Ack(uint tick);
+	const vector<CharacterState>* GetSent(uint tick) const;
+
+private:
+	struct Frame
+	{
+		uint tick;
+		bool valid;
+		vector<CharacterState> states;
+	};
+
+	Frame history[HISTORY];
+	uint acked;
+	bool have_ack;
+};
+
+// Client side, decodes snapshots and keeps received ones as baselines. Lost or late snapshots are fine as long as
+// baseline was received, acknowledged tick is always received one.
+class ReplicationReceiver
+{
+public:
+	ReplicationReceiver();
+	bool Decode(const byte* data, uint size);
+	uint GetTick() const { return last_tick; } // newest decoded tick, to acknowledge
+	const vector<CharacterState>& GetStates() const { return current->states; }
+
+private:
+	struct Frame
+	{
+		uint tick;
+		bool valid;
+		vector<CharacterState> states;
+	};
+
+	Frame history[ReplicationSender::HISTORY];
+	Frame* current;
+	uint last_tick;
+};
+
+// In process transport for benchmarks & tests, packets arrive after fixed latency (in ticks), some are dropped
+// with deterministic pseudo random loss.
+class LoopbackTransport
+{
+public:
+	LoopbackTransport(uint latency, float loss, uint seed);
+	void Send(uint time, const vector<byte>& data);
+	bool Receive(uint time, vector<byte>& data);
+	uint64 GetSentBytes() const { return sent_bytes; }
+	uint GetSentCount() const { return sent_count; }
+	uint GetLostCount() const { return lost_count; }
+
+private:
+	struct Packet
+	{
+		uint time;
+		vector<byte> data;
+	};
+
+	std::deque<Packet> queue;
+	uint64 sent_bytes;
+	uint latency, sent_count, lost_count, rng;
+	float loss;
+};
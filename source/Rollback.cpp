@@ -0,0 +1,30 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "Rollback.h"
+#include "Trace.h"
+
+Rollback::Rollback(Player* player) : player(player), tick(0), count(0)
+{
+	entries.resize(MAX_TICKS);
+}
+
+void Rollback::Save(const PlayerInput& input)
+{
+	Entry& entry = entries[tick % MAX_TICKS];
+	player->SaveSnapshot(entry.snapshot);
+	entry.input = input;
+	++tick;
+	count = Min(count + 1, MAX_TICKS);
+}
+
+// ticks after restored one are dropped, they must be saved again when simulated
+bool Rollback::Restore(uint tick)
+{
+	TRACE_ZONE("Rollback::Restore");
+	if(!HaveTick(tick))
+		return false;
+	player->LoadSnapshot(entries[tick % MAX_TICKS].snapshot);
+	count -= this->tick - tick;
+	this->tick = tick;
+	return true;
+}
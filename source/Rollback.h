@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Player.h"
+
+// Player state & input of last MAX_TICKS ticks in fixed ring buffer for client side prediction. Save is called before
+// each tick, Restore rewinds to state from before older tick so ticks from it can be simulated again with corrected
+// input. Snapshots are plain data copied into buffer allocated once, so rewind & resimulation don't allocate.
+class Rollback
+{
+public:
+	static const uint MAX_TICKS = 32;
+
+	explicit Rollback(Player* player);
+	void Save(const PlayerInput& input);
+	bool Restore(uint tick);
+	bool HaveTick(uint tick) const { return tick < this->tick && this->tick - tick <= count; }
+	uint GetTick() const { return tick; } // next tick to save
+	const PlayerInput& GetInput(uint tick) const { return entries[tick % MAX_TICKS].input; }
+
+private:
+	struct Entry
+	{
+		Player::Snapshot snapshot;
+		PlayerInput input;
+	};
+
+	Player* player;
+	btAlignedObjectArray<Entry> entries;
+	uint tick, count;
+};
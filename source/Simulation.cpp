@@ -0,0 +1,584 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "Simulation.h"
+#include "AnimationMachine.h"
+#include "CharacterControllerSystem.h"
+#include "CmdLine.h"
+#include "CollisionWorld.h"
+#include "InputRecording.h"
+#include "Level.h"
+#include "Replication.h"
+#include "Rollback.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+bool InputScript::Load(cstring path)
+{
+	std::ifstream file(path);
+	if(!file)
+		return false;
+
+	entries.clear();
+	string line;
+	while(std::getline(file, line))
+	{
+		if(line.empty() || line[0] == '#')
+			continue;
+		std::istringstream s(line);
+		Entry e;
+		e.input.walk = false;
+		e.input.jump = false;
+		if(!(s >> e.ticks >> e.input.dir >> e.input.rot) || e.ticks == 0)
+			return false;
+		string flag;
+		while(s >> flag)
+		{
+			if(flag == "walk")
+				e.input.walk = true;
+			else if(flag == "jump")
+				e.input.jump = true;
+			else
+				return false;
+		}
+		entries.push_back(e);
+	}
+	return !entries.empty();
+}
+
+void InputScript::SetDefault()
+{
+	// run forward, turn, walk back, jump and stand
+	const Entry default_entries[] = {
+		{ 120, { PI * 3 / 2, 10, false, false } },
+		{ 60, { PI, 11, false, false } },
+		{ 60, { PI, -10, true, false } },
+		{ 60, { PI / 2, 1, false, true } },
+		{ 60, { PI / 2, 0, false, false } }
+	};
+	entries.assign(std::begin(default_entries), std::end(default_entries));
+}
+
+uint InputScript::GetLength() const
+{
+	uint length = 0;
+	for(const Entry& e : entries)
+		length += e.ticks;
+	return length;
+}
+
+PlayerInput InputScript::Get(uint tick) const
+{
+	tick %= GetLength();
+	for(const Entry& e : entries)
+	{
+		if(tick < e.ticks)
+		{
+			PlayerInput input = e.input;
+			input.jump = input.jump && tick == 0;
+			return input;
+		}
+		tick -= e.ticks;
+	}
+	return entries.back().input;
+}
+
+Simulation::Simulation()
+{
+	world = new CollisionWorld;
+
+	level = new Level(world->Get());
+	if(!level->Load(LEVEL_PATH, nullptr))
+		level->CreateCollision();
+
+	controllers = new CharacterControllerSystem(world->Get());
+	anim_machine = new AnimationMachine;
+	if(!anim_machine->Load(HUMAN_ANIM_PATH, nullptr))
+		anim_machine->SetDefault(nullptr);
+	player = new Player(controllers, anim_machine, true);
+}
+
+Simulation::~Simulation()
+{
+	DeleteElements(agents);
+	delete player;
+	delete anim_machine;
+	delete controllers;
+	delete level;
+	delete world;
+}
+
+btCollisionWorld* Simulation::GetWorld()
+{
+	return world->Get();
+}
+
+// spawn agents on grid, area grows with count so crowd density stays similar, level floor is enlarged to fit
+void Simulation::AddAgents(uint count, uint seed, CharacterController::GroundMode ground)
+{
+	const uint columns = (uint)ceil(sqrt(float(count)));
+	const float area = Max(7.f, columns * 0.9f);
+	level->SetFloorSize(area + 1.f);
+	const float step = area * 2 / columns;
+
+	agents.reserve(agents.size() + count);
+	brains.reserve(brains.size() + count);
+	for(uint i = 0; i < count; ++i)
+	{
+		Player* agent = new Player(controllers, anim_machine, true);
+		agent->controller->setGroundMode(ground);
+		agent->Warp(Vec3(-area + step * (i % columns + 0.5f), 0.f, -area + step * (i / columns + 0.5f)));
+		agents.push_back(agent);
+		brains.push_back(AiBrain(seed + i * 7919u, area));
+	}
+}
+
+void Simulation::SetThreadPool(ThreadPool* pool)
+{
+	controllers->SetThreadPool(pool);
+}
+
+void Simulation::Tick(const PlayerInput& input)
+{
+	player->Update(TICK, input);
+	for(uint i = 0; i < agents.size(); ++i)
+		agents[i]->Update(TICK, brains[i].Think(*agents[i]));
+	controllers->Update(TICK);
+	player->PostUpdate();
+	for(Player* agent : agents)
+		agent->PostUpdate();
+}
+
+// run headless simulation: -headless [-script path] [-ticks count]
+// or replay recorded input: -replay path [-repeat count] [-out path]
+// or crowd stress test: -stress max_agents [-ticks count] [-threads count] [-ground sweep|rays] [-budget ms] [-seed seed] [-out path]
+// or client prediction with rollback: -rollback [-depth ticks] [-script path] [-ticks count]
+// or replication over loopback: -replicate [-clients count] [-agents count] [-ticks count] [-latency ticks] [-loss ratio] [-seed seed]
+int Simulation::Main(const CmdLine& cmd)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	Logger::SetInstance(new ConsoleLogger);
+	if(cmd.Has("replay"))
+		return Replay(cmd);
+	if(cmd.Has("stress"))
+		return Stress(cmd);
+	if(cmd.Has("rollback"))
+		return Resimulate(cmd);
+	if(cmd.Has("replicate"))
+		return Replicate(cmd);
+
+	InputScript script;
+	if(!LoadScript(cmd, script))
+		return 1;
+	const uint ticks = (uint)cmd.GetInt("ticks", script.GetLength());
+
+	Clock::time_point start = Clock::now();
+	Simulation* sim = new Simulation;
+	Clock::time_point start_sim = Clock::now();
+	for(uint i = 0; i < ticks; ++i)
+		sim->Tick(script.Get(i));
+	Clock::time_point end = Clock::now();
+
+	const double init_ms = std::chrono::duration<double, std::milli>(start_sim - start).count();
+	const double tick_ns = ticks ? std::chrono::duration<double, std::nano>(end - start_sim).count() / ticks : 0.;
+	const Vec3& pos = sim->GetPlayer()->pos;
+	Info(Format("Headless: %u ticks, init %.3f ms, %.0f ns/tick, final pos (%g, %g, %g).", ticks, init_ms, tick_ns, pos.x, pos.y, pos.z));
+
+	delete sim;
+	return 0;
+}
+
+bool Simulation::LoadScript(const CmdLine& cmd, InputScript& script)
+{
+	cstring path = cmd.Get("script");
+	if(!path)
+	{
+		script.SetDefault();
+		return true;
+	}
+	if(!script.Load(path))
+	{
+		Error(Format("Headless: Failed to load script '%s'.", path));
+		return false;
+	}
+	return true;
+}
+
+// Replays recording (repeated for stable timings) and verifies position checksum after every tick.
+// Per tick checksums & best time are saved as csv when -out is set. Returns 1 if trajectory changed.
+int Simulation::Replay(const CmdLine& cmd)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	cstring path = cmd.Get("replay");
+	InputRecording recording;
+	if(!path || !recording.Load(path))
+	{
+		Error(Format("Replay: Failed to load recording '%s'.", path ? path : ""));
+		return 1;
+	}
+	const uint ticks = recording.GetCount();
+	const uint repeat = (uint)cmd.GetInt("repeat", 1);
+	const uint runs = repeat ? repeat : 1;
+	cstring out = cmd.Get("out");
+
+	vector<uint> checksums(ticks);
+	vector<double> best_ns(ticks, 0.);
+	double best_total_ms = 0., sum_total_ms = 0.;
+	for(uint r = 0; r < runs; ++r)
+	{
+		Simulation* sim = new Simulation;
+		CharacterController* controller = sim->GetPlayer()->controller;
+		Clock::duration total = Clock::duration::zero();
+		for(uint i = 0; i < ticks; ++i)
+		{
+			Clock::time_point start = Clock::now();
+			sim->Tick(recording.Get(i).input);
+			const Clock::duration time = Clock::now() - start;
+			total += time;
+			const double ns = std::chrono::duration<double, std::nano>(time).count();
+			if(r == 0 || ns < best_ns[i])
+				best_ns[i] = ns;
+			checksums[i] = InputRecording::Checksum(controller->getPos());
+		}
+		delete sim;
+
+		const double total_ms = std::chrono::duration<double, std::milli>(total).count();
+		if(r == 0 || total_ms < best_total_ms)
+			best_total_ms = total_ms;
+		sum_total_ms += total_ms;
+	}
+
+	uint mismatches = 0, first_mismatch = 0;
+	for(uint i = 0; i < ticks; ++i)
+	{
+		if(checksums[i] != recording.Get(i).checksum)
+		{
+			if(mismatches++ == 0)
+				first_mismatch = i;
+		}
+	}
+
+	if(out)
+	{
+		std::ofstream file(out);
+		if(!file)
+		{
+			Error(Format("Replay: Failed to open '%s'.", out));
+			return 1;
+		}
+		file << "tick,expected,checksum,ns\n";
+		for(uint i = 0; i < ticks; ++i)
+			file << i << "," << recording.Get(i).checksum << "," << checksums[i] << "," << best_ns[i] << "\n";
+	}
+
+	Info(Format("Replay: %u ticks x %u, best %.3f ms (%.0f ns/tick), avg %.3f ms.", ticks, runs, best_total_ms,
+		ticks ? best_total_ms * 1000000 / ticks : 0., sum_total_ms / runs));
+	if(mismatches)
+	{
+		Error(Format("Replay: Trajectory differs in %u ticks, first at tick %u.", mismatches, first_mismatch));
+		return 1;
+	}
+	Info("Replay: Trajectory matches recording.");
+	return 0;
+}
+
+// Runs crowd of AI agents with agent count doubling up to max, reports cost per tick & per agent for each size.
+// Warns at first size where average tick takes longer than budget. Rows are saved as csv when -out is set.
+int Simulation::Stress(const CmdLine& cmd)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	const uint WARMUP_TICKS = 60;
+
+	const uint max_agents = (uint)cmd.GetInt("stress", 256);
+	const uint ticks = (uint)cmd.GetInt("ticks", 600);
+	const uint threads = (uint)cmd.GetInt("threads", 1);
+	const uint seed = (uint)cmd.GetInt("seed", 1);
+	const float budget_ms = cmd.GetFloat("budget", 2.f);
+	cstring ground_name = cmd.Get("ground", "rays");
+	cstring out = cmd.Get("out");
+	if(max_agents == 0 || ticks == 0)
+	{
+		Error("Stress: Agents and ticks count must be greater than zero.");
+		return 1;
+	}
+
+	CharacterController::GroundMode ground;
+	if(strcmp(ground_name, "rays") == 0)
+		ground = CharacterController::GROUND_RAYS;
+	else if(strcmp(ground_name, "sweep") == 0)
+		ground = CharacterController::GROUND_SWEEP;
+	else
+	{
+		Error(Format("Stress: Unknown ground mode '%s'.", ground_name));
+		return 1;
+	}
+
+	std::ofstream file;
+	if(out)
+	{
+		file.open(out);
+		if(!file)
+		{
+			Error(Format("Stress: Failed to open '%s'.", out));
+			return 1;
+		}
+		file << "agents,avg_ms,max_ms,ns_per_agent\n";
+	}
+
+	ThreadPool* pool = threads > 1 ? new ThreadPool(threads) : nullptr;
+	PlayerInput idle;
+	idle.rot = 0.f;
+	idle.dir = 0;
+	idle.walk = false;
+	idle.jump = false;
+
+	double first_ns_per_agent = 0.;
+	uint over_budget = 0;
+	for(uint count = 1;; count = Min(count * 2, max_agents))
+	{
+		Simulation* sim = new Simulation;
+		sim->SetThreadPool(pool);
+		sim->AddAgents(count, seed, ground);
+		for(uint i = 0; i < WARMUP_TICKS; ++i)
+			sim->Tick(idle);
+
+		Clock::duration total = Clock::duration::zero(), worst = Clock::duration::zero();
+		for(uint i = 0; i < ticks; ++i)
+		{
+			Clock::time_point start = Clock::now();
+			sim->Tick(idle);
+			const Clock::duration time = Clock::now() - start;
+			total += time;
+			if(time > worst)
+				worst = time;
+		}
+		delete sim;
+
+		const double avg_ms = std::chrono::duration<double, std::milli>(total).count() / ticks;
+		const double max_ms = std::chrono::duration<double, std::milli>(worst).count();
+		const double ns_per_agent = avg_ms * 1000000 / count;
+		if(count == 1)
+			first_ns_per_agent = ns_per_agent;
+		Info(Format("Stress: %u agents, %.3f ms/tick (max %.3f), %.0f ns/agent (%.2fx of single agent).", count, avg_ms, max_ms, ns_per_agent,
+			ns_per_agent / first_ns_per_agent));
+		if(out)
+			file << count << "," << avg_ms << "," << max_ms << "," << ns_per_agent << "\n";
+		if(avg_ms > budget_ms && over_budget == 0)
+			over_budget = count;
+
+		if(count == max_agents)
+			break;
+	}
+	delete pool;
+
+	if(over_budget)
+		Warn(Format("Stress: Tick exceeds %g ms budget at %u agents.", budget_ms, over_budget));
+	else
+		Info(Format("Stress: All sizes fit in %g ms budget.", budget_ms));
+	return 0;
+}
+
+// Client prediction: ticks are simulated with predicted input (last confirmed one), then input of tick depth - 1 ticks
+// back is confirmed, player is rewound to it and all ticks since are simulated again (worst case, even when prediction
+// was right). Confirmed ticks must match simulation with correct input from start. Reports restore & resimulation cost.
+int Simulation::Resimulate(const CmdLine& cmd)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	InputScript script;
+	if(!LoadScript(cmd, script))
+		return 1;
+	const uint ticks = (uint)cmd.GetInt("ticks", script.GetLength());
+	const uint depth = Clamp((uint)cmd.GetInt("depth", 10), 1u, Rollback::MAX_TICKS);
+
+	vector<uint> expected(ticks);
+	Simulation* sim = new Simulation;
+	for(uint i = 0; i < ticks; ++i)
+	{
+		sim->Tick(script.Get(i));
+		expected[i] = InputRecording::Checksum(sim->GetPlayer()->controller->getPos());
+	}
+	delete sim;
+
+	sim = new Simulation;
+	Rollback* rollback = new Rollback(sim->GetPlayer());
+	const CharacterController* controller = sim->GetPlayer()->controller;
+	Clock::duration restore_time = Clock::duration::zero(), resimulate_time = Clock::duration::zero(), max_time = Clock::duration::zero();
+	uint frames = 0, corrected = 0, mismatches = 0, first_mismatch = 0;
+	for(uint t = 0; t < ticks; ++t)
+	{
+		PlayerInput input;
+		if(t >= depth)
+		{
+			input = script.Get(t - depth);
+			input.jump = false;
+		}
+		else
+		{
+			input.rot = 0;
+			input.dir = 0;
+			input.walk = false;
+			input.jump = false;
+		}
+		rollback->Save(input);
+		sim->Tick(input);
+
+		if(t + 1 < depth)
+			continue;
+		const uint confirmed = t + 1 - depth;
+		const PlayerInput& predicted = rollback->GetInput(confirmed);
+		const PlayerInput correct = script.Get(confirmed);
+		if(predicted.dir != correct.dir || predicted.rot != correct.rot || predicted.walk != correct.walk || predicted.jump != correct.jump)
+			++corrected;
+
+		Clock::time_point start = Clock::now();
+		rollback->Restore(confirmed);
+		Clock::time_point restored = Clock::now();
+		for(uint i = confirmed; i <= t; ++i)
+		{
+			input = i == confirmed ? correct : rollback->GetInput(i);
+			rollback->Save(input);
+			sim->Tick(input);
+			if(i == confirmed && InputRecording::Checksum(controller->getPos()) != expected[i])
+			{
+				if(mismatches++ == 0)
+					first_mismatch = i;
+			}
+		}
+		Clock::time_point end = Clock::now();
+		restore_time += restored - start;
+		resimulate_time += end - restored;
+		max_time = Max(max_time, end - start);
+		++frames;
+	}
+	delete rollback;
+	delete sim;
+
+	Info(Format("Rollback: %u ticks, depth %u, %u corrected inputs, restore %.0f ns, resimulation %.1f us/frame (max %.1f us with restore).",
+		ticks, depth, corrected, frames ? std::chrono::duration<double, std::nano>(restore_time).count() / frames : 0.,
+		frames ? std::chrono::duration<double, std::micro>(resimulate_time).count() / frames : 0.,
+		std::chrono::duration<double, std::micro>(max_time).count()));
+	if(mismatches)
+	{
+		Error(Format("Rollback: Resimulated trajectory differs in %u ticks, first at tick %u.", mismatches, first_mismatch));
+		return 1;
+	}
+	Info("Rollback: Resimulated trajectory matches.");
+	return 0;
+}
+
+// Server replicates player & AI agents to clients over loopback transport with latency & packet loss, clients ack
+// newest received snapshot. Every decoded snapshot must equal what server sent. Reports bandwidth & codec throughput.
+int Simulation::Replicate(const CmdLine& cmd)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const uint client_count = Max((uint)cmd.GetInt("clients", 8), 1u);
+	const uint agent_count = (uint)cmd.GetInt("agents", 63);
+	const uint ticks = (uint)cmd.GetInt("ticks", 600);
+	const uint latency = (uint)cmd.GetInt("latency", 6);
+	const float loss = cmd.GetFloat("loss", 0.05f);
+	const uint seed = (uint)cmd.GetInt("seed", 1);
+
+	InputScript script;
+	script.SetDefault();
+	Simulation* sim = new Simulation;
+	sim->AddAgents(agent_count, seed, CharacterController::GROUND_SWEEP);
+
+	struct Client
+	{
+		ReplicationSender sender;
+		ReplicationReceiver receiver;
+		LoopbackTransport* down, *up;
+	};
+	vector<Client*> clients(client_count);
+	for(uint i = 0; i < client_count; ++i)
+	{
+		Client* client = new Client;
+		client->down = new LoopbackTransport(latency, loss, seed + i * 2);
+		client->up = new LoopbackTransport(latency, loss, seed + i * 2 + 1);
+		clients[i] = client;
+	}
+
+	vector<CharacterState> states;
+	BitWriter writer;
+	vector<byte> packet;
+	Clock::duration encode_time = Clock::duration::zero(), decode_time = Clock::duration::zero();
+	uint decoded = 0, rejected = 0, mismatches = 0;
+	for(uint tick = 0; tick < ticks; ++tick)
+	{
+		sim->Tick(script.Get(tick));
+		states.resize(sim->agents.size() + 1);
+		states[0] = CharacterState::FromPlayer(*sim->player);
+		for(uint i = 0; i < sim->agents.size(); ++i)
+			states[i + 1] = CharacterState::FromPlayer(*sim->agents[i]);
+
+		for(Client* client : clients)
+		{
+			while(client->up->Receive(tick, packet))
+			{
+				uint acked;
+				memcpy(&acked, packet.data(), sizeof(acked));
+				client->sender.Ack(acked);
+			}
+
+			Clock::time_point start = Clock::now();
+			writer.Clear();
+			client->sender.Encode(tick, states, writer);
+			encode_time += Clock::now() - start;
+			client->down->Send(tick, writer.GetData());
+
+			while(client->down->Receive(tick, packet))
+			{
+				start = Clock::now();
+				const bool ok = client->receiver.Decode(packet.data(), (uint)packet.size());
+				decode_time += Clock::now() - start;
+				if(!ok)
+				{
+					++rejected;
+					continue;
+				}
+				++decoded;
+				const uint received = client->receiver.GetTick();
+				const vector<CharacterState>* sent = client->sender.GetSent(received);
+				if(!sent || *sent != client->receiver.GetStates())
+					++mismatches;
+				packet.resize(sizeof(received));
+				memcpy(packet.data(), &received, sizeof(received));
+				client->up->Send(tick, packet);
+			}
+		}
+	}
+
+	uint64 bytes = 0;
+	uint sent = 0, lost = 0;
+	for(Client* client : clients)
+	{
+		bytes += client->down->GetSentBytes();
+		sent += client->down->GetSentCount();
+		lost += client->down->GetLostCount();
+		delete client->down;
+		delete client->up;
+		delete client;
+	}
+	delete sim;
+
+	const uint characters = agent_count + 1;
+	const double bytes_per_tick = double(bytes) / client_count / ticks;
+	const double encode_ns = std::chrono::duration<double, std::nano>(encode_time).count() / (double(client_count) * ticks * characters);
+	const double decode_ns = decoded ? std::chrono::duration<double, std::nano>(decode_time).count() / (double(decoded) * characters) : 0.;
+	Info(Format("Replicate: %u clients, %u characters, %u ticks, latency %u, loss %u/%u packets.", client_count, characters, ticks, latency,
+		lost, sent));
+	Info(Format("Replicate: %.1f bytes/tick per client (%.2f bytes/character, raw %u), %.0f kbit/s at 60 ticks.", bytes_per_tick,
+		bytes_per_tick / characters, (uint)sizeof(float) * CharacterState::F_MAX, bytes_per_tick * 60 * 8 / 1000));
+	Info(Format("Replicate: encode %.1f ns/character, decode %.1f ns/character, %u snapshots rejected.", encode_ns, decode_ns, rejected));
+	if(mismatches)
+	{
+		Error(Format("Replicate: %u decoded snapshots differ from sent ones.", mismatches));
+		return 1;
+	}
+	return 0;
+}
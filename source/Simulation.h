@@ -0,0 +1,54 @@
+#pragma once
+
+#include <btBulletCollisionCommon.h>
+#include "AiBrain.h"
+#include "CharacterController.h"
+
+// Scripted input for headless simulation, each line: <ticks> <dir> <rot> [walk] [jump]
+// jump is applied only on first tick of line, script is looped
+struct InputScript
+{
+	struct Entry
+	{
+		uint ticks;
+		PlayerInput input;
+	};
+
+	bool Load(cstring path);
+	void SetDefault();
+	uint GetLength() const;
+	PlayerInput Get(uint tick) const;
+
+	vector<Entry> entries;
+};
+
+// Movement simulation at fixed tick without engine, render, gui or audio.
+// Optional AI agents use same Player code as player, driven by AiBrain input.
+class Simulation
+{
+public:
+	Simulation();
+	~Simulation();
+	void AddAgents(uint count, uint seed, CharacterController::GroundMode ground);
+	void SetThreadPool(ThreadPool* pool);
+	void Tick(const PlayerInput& input);
+	Player* GetPlayer() { return player; }
+	btCollisionWorld* GetWorld();
+
+	static int Main(const CmdLine& cmd);
+
+private:
+	static int Replay(const CmdLine& cmd);
+	static int Stress(const CmdLine& cmd);
+	static int Resimulate(const CmdLine& cmd);
+	static int Replicate(const CmdLine& cmd);
+	static bool LoadScript(const CmdLine& cmd, InputScript& script);
+
+	CollisionWorld* world;
+	Level* level;
+	CharacterControllerSystem* controllers;
+	AnimationMachine* anim_machine; // without mesh, only evaluates animation states (replicated)
+	Player* player;
+	vector<Player*> agents;
+	vector<AiBrain> brains;
+};
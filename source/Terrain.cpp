@@ -0,0 +1,146 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "Terrain.h"
+#include <BulletCollision\CollisionShapes\btHeightfieldTerrainShape.h>
+
+namespace
+{
+	// highest sphere center on vertical line (x,z) touching triangle abc, triangle normal n must point up
+	// best_normal is direction from contact point to sphere center
+	void SphereRestOnTriangle(const btVector3& a, const btVector3& b, const btVector3& c, const btVector3& n, btScalar x, btScalar z, btScalar radius,
+		btScalar& best, btVector3& best_normal, bool& found)
+	{
+		// face: center at radius distance above plane, contact point inside triangle
+		{
+			const btScalar plane_y = a.y() - (n.x() * (x - a.x()) + n.z() * (z - a.z())) / n.y();
+			const btScalar y = plane_y + radius / n.y();
+			const btVector3 contact = btVector3(x, y, z) - n * radius;
+			const btVector3 e0 = b - a, e1 = c - b, e2 = a - c;
+			if(e0.cross(contact - a).dot(n) >= 0 && e1.cross(contact - b).dot(n) >= 0 && e2.cross(contact - c).dot(n) >= 0)
+			{
+				if(!found || y > best)
+				{
+					best = y;
+					best_normal = n;
+					found = true;
+				}
+				return; // face contact is highest possible for this triangle
+			}
+		}
+
+		const btVector3* verts[3] = { &a, &b, &c };
+		for(int i = 0; i < 3; ++i)
+		{
+			const btVector3& p0 = *verts[i];
+			const btVector3& p1 = *verts[(i + 1) % 3];
+
+			// vertex
+			const btScalar dx = x - p0.x(), dz = z - p0.z();
+			const btScalar d2 = dx * dx + dz * dz;
+			if(d2 <= radius * radius)
+			{
+				const btScalar y = p0.y() + btSqrt(radius * radius - d2);
+				if(!found || y > best)
+				{
+					best = y;
+					best_normal = (btVector3(x, y, z) - p0) / radius;
+					found = true;
+				}
+			}
+
+			// edge: distance from (x,y,z) to line p0-p1 equals radius, solve quadratic for y
+			const btVector3 edge = p1 - p0;
+			const btScalar length = edge.length();
+			if(length < SIMD_EPSILON)
+				continue;
+			const btVector3 e = edge / length;
+			const btVector3 w0(x - p0.x(), -p0.y(), z - p0.z());
+			const btScalar w0e = w0.dot(e);
+			const btScalar qa = 1 - e.y() * e.y();
+			const btScalar qb = 2 * (w0.y() - w0e * e.y());
+			const btScalar qc = w0.length2() - w0e * w0e - radius * radius;
+			const btScalar delta = qb * qb - 4 * qa * qc;
+			if(qa < SIMD_EPSILON || delta < 0)
+				continue;
+			const btScalar y = (-qb + btSqrt(delta)) / (2 * qa);
+			const btScalar s = w0e + y * e.y();
+			if(s >= 0 && s <= length && (!found || y > best))
+			{
+				best = y;
+				best_normal = (btVector3(x, y, z) - (p0 + e * s)) / radius;
+				found = true;
+			}
+		}
+	}
+}
+
+Terrain::Terrain(uint width, uint length, float cell_size, const float* heights) : heights(heights, heights + (width + 1) * (length + 1)),
+	width(width), length(length), cell_size(cell_size)
+{
+	min_height = max_height = this->heights[0];
+	for(float h : this->heights)
+	{
+		if(h < min_height)
+			min_height = h;
+		if(h > max_height)
+			max_height = h;
+	}
+
+	// bullet centers heightfield aabb at shape origin
+	shape = new btHeightfieldTerrainShape(width + 1, length + 1, this->heights.data(), 1.f, min_height, max_height, 1, PHY_FLOAT, false);
+	shape->setLocalScaling(btVector3(cell_size, 1.f, cell_size));
+	transform.setIdentity();
+	transform.setOrigin(btVector3(0, (min_height + max_height) / 2, 0));
+	offset = btVector3(-(width * cell_size) / 2, 0, -(length * cell_size) / 2);
+}
+
+Terrain::~Terrain()
+{
+	delete shape;
+}
+
+btCollisionShape* Terrain::GetShape()
+{
+	return shape;
+}
+
+// height of terrain surface, same triangulation as btHeightfieldTerrainShape (quad split from (x,z+1) to (x+1,z))
+float Terrain::GetHeight(float x, float z) const
+{
+	const float fx = Clamp((x - offset.x()) / cell_size, 0.f, (float)width);
+	const float fz = Clamp((z - offset.z()) / cell_size, 0.f, (float)length);
+	const uint cx = Min((uint)fx, width - 1), cz = Min((uint)fz, length - 1);
+	const float tx = fx - cx, tz = fz - cz;
+	const float h00 = GetSample(cx, cz), h10 = GetSample(cx + 1, cz), h01 = GetSample(cx, cz + 1), h11 = GetSample(cx + 1, cz + 1);
+	if(tx + tz <= 1.f)
+		return h00 + (h10 - h00) * tx + (h01 - h00) * tz;
+	else
+		return h11 + (h01 - h11) * (1.f - tx) + (h10 - h11) * (1.f - tz);
+}
+
+// Highest position of sphere center at (x,z) that touches terrain without penetrating, checks triangles of cells under sphere.
+// Normal is direction from contact point to sphere center. Returns false when sphere is outside of terrain.
+bool Terrain::GetSphereRestHeight(btScalar x, btScalar z, btScalar radius, btScalar& y, btVector3& normal) const
+{
+	const btScalar lx = x - offset.x(), lz = z - offset.z();
+	const int x1 = (int)floor((lx - radius) / cell_size), x2 = (int)floor((lx + radius) / cell_size);
+	const int z1 = (int)floor((lz - radius) / cell_size), z2 = (int)floor((lz + radius) / cell_size);
+	if(x2 < 0 || z2 < 0 || x1 >= (int)width || z1 >= (int)length)
+		return false;
+
+	bool found = false;
+	for(int cz = Max(z1, 0), cz_end = Min(z2, (int)length - 1); cz <= cz_end; ++cz)
+	{
+		for(int cx = Max(x1, 0), cx_end = Min(x2, (int)width - 1); cx <= cx_end; ++cx)
+		{
+			const btVector3 p00(offset.x() + cell_size * cx, GetSample(cx, cz), offset.z() + cell_size * cz);
+			const btVector3 p10(p00.x() + cell_size, GetSample(cx + 1, cz), p00.z());
+			const btVector3 p01(p00.x(), GetSample(cx, cz + 1), p00.z() + cell_size);
+			const btVector3 p11(p00.x() + cell_size, GetSample(cx + 1, cz + 1), p00.z() + cell_size);
+			// counter clockwise seen from above so normals point up
+			SphereRestOnTriangle(p00, p01, p10, (p01 - p00).cross(p10 - p00).normalized(), x, z, radius, y, normal, found);
+			SphereRestOnTriangle(p10, p01, p11, (p01 - p10).cross(p11 - p10).normalized(), x, z, radius, y, normal, found);
+		}
+	}
+	return found;
+}
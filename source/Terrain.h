@@ -0,0 +1,29 @@
+#pragma once
+
+#include <btBulletCollisionCommon.h>
+
+class btHeightfieldTerrainShape;
+
+// Heightfield terrain collision centered at origin, (width+1) x (length+1) height samples with cell size spacing.
+// Collision object user pointer is set to terrain, character controllers standing only on terrain use
+// analytic GetSphereRestHeight instead of convex sweeps to find ground.
+class Terrain
+{
+public:
+	Terrain(uint width, uint length, float cell_size, const float* heights);
+	~Terrain();
+	btCollisionShape* GetShape();
+	const btTransform& GetTransform() const { return transform; }
+	float GetHeight(float x, float z) const;
+	bool GetSphereRestHeight(btScalar x, btScalar z, btScalar radius, btScalar& y, btVector3& normal) const;
+
+private:
+	float GetSample(uint x, uint z) const { return heights[x + z * (width + 1)]; }
+
+	vector<float> heights;
+	uint width, length;
+	float cell_size, min_height, max_height;
+	btVector3 offset; // position of sample (0,0) with height 0
+	btTransform transform;
+	btHeightfieldTerrainShape* shape;
+};
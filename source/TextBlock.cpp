@@ -0,0 +1,33 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "TextBlock.h"
+
+TextBlock::TextBlock(Font* font, uint flags, int max_width) : font(font), size(0, 0), key(0), flags(flags), rebuilds(0),
+	max_width(max_width), valid(false)
+{
+}
+
+// same text keeps layout, even if key changed
+void TextBlock::SetText(cstring new_text)
+{
+	if(text == new_text)
+		return;
+	text = new_text;
+	++rebuilds;
+	lines.clear();
+	size = Int2(0, 0);
+	if(text.empty())
+		return;
+	font->SplitLines(lines, text, max_width, flags);
+	for(const TextLine& line : lines)
+		size.x = Max(size.x, line.width);
+	size.y = (int)lines.size() * font->height;
+}
+
+void TextBlock::Draw(const Int2& pos, Color color) const
+{
+	if(lines.empty())
+		return;
+	app::gui->DrawText(font, text, flags, color, Rect(pos.x, pos.y, pos.x + size.x + 2, pos.y + size.y + 2), nullptr, nullptr,
+		nullptr, &lines);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Gui.h>
+
+// Retained text for gui. Keeps formatted string, split lines and measured size between frames and rebuilds them only
+// when bound values change (caller passes key made from them), so static text costs only the draw call.
+class TextBlock
+{
+public:
+	explicit TextBlock(Font* font, uint flags = DTF_OUTLINE, int max_width = 10000);
+	template<typename Builder>
+	void Update(uint64 key, Builder builder)
+	{
+		if(!valid || key != this->key)
+		{
+			this->key = key;
+			valid = true;
+			SetText(builder());
+		}
+	}
+	void SetText(cstring new_text);
+	void SetText(const string& new_text) { SetText(new_text.c_str()); }
+	void Draw(const Int2& pos, Color color) const;
+	const Int2& GetSize() const { return size; }
+	uint GetRebuildCount() const { return rebuilds; }
+
+	template<typename... T>
+	static uint64 Key(T... values)
+	{
+		uint64 key = 14695981039346656037ull;
+		((key = Combine(key, values)), ...);
+		return key;
+	}
+
+private:
+	// fnv-1a over value bytes
+	template<typename T>
+	static uint64 Combine(uint64 key, T value)
+	{
+		const byte* data = reinterpret_cast<const byte*>(&value);
+		for(uint i = 0; i < sizeof(T); ++i)
+			key = (key ^ data[i]) * 1099511628211ull;
+		return key;
+	}
+
+	Font* font;
+	string text;
+	vector<TextLine> lines;
+	Int2 size;
+	uint64 key;
+	uint flags, rebuilds;
+	int max_width;
+	bool valid;
+};
@@ -0,0 +1,97 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(uint thread_count) : func(nullptr), count(0), chunk(1), generation(0), busy(0), next(0), quit(false)
+{
+	if(thread_count == 0)
+		thread_count = 1;
+	for(uint i = 1; i < thread_count; ++i)
+		workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	cv_start.notify_all();
+	for(std::thread& worker : workers)
+		worker.join();
+}
+
+void ThreadPool::ParallelFor(uint count, const std::function<void(uint)>& func)
+{
+	if(count == 0)
+		return;
+	if(workers.empty() || count == 1)
+	{
+		for(uint i = 0; i < count; ++i)
+			func(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->func = &func;
+		this->count = count;
+		chunk = count / (GetThreadCount() * 4);
+		if(chunk == 0)
+			chunk = 1;
+		next = 0;
+		busy = (uint)workers.size();
+		++generation;
+	}
+	cv_start.notify_all();
+
+	RunChunks();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	cv_done.wait(lock, [this] { return busy == 0; });
+	this->func = nullptr;
+}
+
+void ThreadPool::WorkerLoop()
+{
+	uint seen = 0;
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv_start.wait(lock, [&] { return quit || generation != seen; });
+			if(quit)
+				return;
+			seen = generation;
+		}
+
+		RunChunks();
+
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			last = (--busy == 0);
+		}
+		if(last)
+			cv_done.notify_one();
+	}
+}
+
+void ThreadPool::RunChunks()
+{
+	while(true)
+	{
+		const uint start = next.fetch_add(chunk);
+		if(start >= count)
+			break;
+		const uint end = (start + chunk < count ? start + chunk : count);
+		for(uint i = start; i < end; ++i)
+			(*func)(i);
+	}
+}
+
+uint ThreadPool::GetDefaultThreadCount()
+{
+	const uint count = std::thread::hardware_concurrency();
+	return count == 0 ? 1u : count;
+}
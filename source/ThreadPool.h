@@ -0,0 +1,32 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Fixed set of worker threads for data parallel loops. Calling thread takes part in work too,
+// so pool with 1 thread have no workers and runs everything inline.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(uint thread_count);
+	~ThreadPool();
+	// calls func(i) for i in [0, count) spread across threads, returns when all are done
+	void ParallelFor(uint count, const std::function<void(uint)>& func);
+	uint GetThreadCount() const { return (uint)workers.size() + 1; }
+	static uint GetDefaultThreadCount();
+
+private:
+	void WorkerLoop();
+	void RunChunks();
+
+	vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable cv_start, cv_done;
+	const std::function<void(uint)>* func;
+	uint count, chunk, generation, busy;
+	std::atomic<uint> next;
+	bool quit;
+};
@@ -0,0 +1,127 @@
+#include "Pch.h"
+#include "GameCore.h"
+#include "Trace.h"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+
+namespace
+{
+	const uint BUFFER_SIZE = 1 << 15; // zones for each thread, power of 2
+	const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+	struct Event
+	{
+		cstring name, detail;
+		int64 start, end;
+		uint frame;
+	};
+
+	void WriteString(std::ostream& out, cstring str)
+	{
+		out << '"';
+		for(; *str; ++str)
+		{
+			if(*str == '"' || *str == '\\')
+				out << '\\';
+			out << *str;
+		}
+		out << '"';
+	}
+}
+
+struct Trace::Buffer
+{
+	Event events[BUFFER_SIZE];
+	std::atomic<uint64> written;
+	uint thread_index;
+};
+
+std::atomic<bool> Trace::enabled(false);
+std::atomic<uint> Trace::frame(0);
+std::mutex Trace::buffers_mutex;
+vector<Trace::Buffer*> Trace::buffers;
+
+int64 Trace::Now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+Trace::Buffer* Trace::GetBuffer()
+{
+	thread_local Buffer* buffer = nullptr;
+	if(!buffer)
+	{
+		buffer = new Buffer;
+		buffer->written.store(0, std::memory_order_relaxed);
+		std::lock_guard<std::mutex> lock(buffers_mutex);
+		buffer->thread_index = (uint)buffers.size();
+		buffers.push_back(buffer);
+	}
+	return buffer;
+}
+
+// only owning thread writes to buffer, oldest zones are overwritten
+void Trace::Record(cstring name, cstring detail, int64 start, int64 end)
+{
+	Buffer* buffer = GetBuffer();
+	const uint64 index = buffer->written.load(std::memory_order_relaxed);
+	Event& e = buffer->events[index & (BUFFER_SIZE - 1)];
+	e.name = name;
+	e.detail = detail;
+	e.start = start;
+	e.end = end;
+	e.frame = GetFrame();
+	buffer->written.store(index + 1, std::memory_order_release);
+}
+
+// can be called while other threads record, zones that could be overwritten during copy are skipped
+bool Trace::Dump(cstring path, uint frames)
+{
+	const uint current = GetFrame();
+	const uint min_frame = (frames == 0 || frames > current) ? 0 : current - frames + 1;
+
+	vector<std::pair<uint, Event>> events;
+	{
+		std::lock_guard<std::mutex> lock(buffers_mutex);
+		vector<Event> copy;
+		for(Buffer* buffer : buffers)
+		{
+			const uint64 end = buffer->written.load(std::memory_order_acquire);
+			const uint64 begin = end > BUFFER_SIZE ? end - BUFFER_SIZE : 0;
+			copy.clear();
+			for(uint64 i = begin; i < end; ++i)
+				copy.push_back(buffer->events[i & (BUFFER_SIZE - 1)]);
+			const uint64 end_after = buffer->written.load(std::memory_order_acquire);
+			// writer may already be overwriting slot of index end_after
+			const uint64 valid = end_after + 1 > BUFFER_SIZE ? end_after + 1 - BUFFER_SIZE : 0;
+			for(uint64 i = Max(begin, valid); i < end; ++i)
+			{
+				const Event& e = copy[uint(i - begin)];
+				if(e.frame >= min_frame)
+					events.push_back(std::make_pair(buffer->thread_index, e));
+			}
+		}
+	}
+
+	std::ofstream file(path);
+	if(!file)
+		return false;
+	file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+	for(uint i = 0; i < (uint)events.size(); ++i)
+	{
+		const Event& e = events[i].second;
+		file << "{\"name\":";
+		WriteString(file, e.name);
+		file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << events[i].first << ",\"ts\":" << e.start / 1000.0 << ",\"dur\":" << (e.end - e.start) / 1000.0
+			<< ",\"args\":{\"frame\":" << e.frame;
+		if(e.detail)
+		{
+			file << ",\"detail\":";
+			WriteString(file, e.detail);
+		}
+		file << "}}" << (i + 1 == events.size() ? "\n" : ",\n");
+	}
+	file << "]}\n";
+	return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+// scoped trace zones, compiled out completely when CC_TRACE is 0
+#ifndef CC_TRACE
+#	define CC_TRACE 1
+#endif
+
+// Records named zones (begin & end time) into per thread ring buffers, each buffer have single writer so no locks are used.
+// Disabled at runtime zone costs two predictable branches (begin and end). Dump writes zones from last frames as Chrome trace event json
+// (open in chrome://tracing or Perfetto). Zone names & details must stay valid until dump (string literals, resource names).
+class Trace
+{
+public:
+	static void Enable(bool enable) { enabled.store(enable, std::memory_order_relaxed); }
+	static bool IsEnabled() { return enabled.load(std::memory_order_relaxed); }
+	static void NextFrame() { frame.fetch_add(1, std::memory_order_relaxed); }
+	static uint GetFrame() { return frame.load(std::memory_order_relaxed); }
+	static int64 Now(); // in ns
+	static void Record(cstring name, cstring detail, int64 start, int64 end);
+	static bool Dump(cstring path, uint frames); // frames 0 dumps everything still in buffers
+
+private:
+	struct Buffer;
+	static Buffer* GetBuffer();
+
+	static std::atomic<bool> enabled;
+	static std::atomic<uint> frame;
+	static std::mutex buffers_mutex;
+	static vector<Buffer*> buffers; // one for each thread that recorded zone, kept until exit
+};
+
+class TraceZone
+{
+public:
+	explicit TraceZone(cstring name, cstring detail = nullptr) : name(nullptr)
+	{
+		if(Trace::IsEnabled())
+		{
+			this->name = name;
+			this->detail = detail;
+			start = Trace::Now();
+		}
+	}
+	~TraceZone()
+	{
+		if(name)
+			Trace::Record(name, detail, start, Trace::Now());
+	}
+
+private:
+	cstring name, detail;
+	int64 start;
+};
+
+#if CC_TRACE
+#	define TRACE_CONCAT2(a, b) a##b
+#	define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#	define TRACE_ZONE(name) TraceZone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+#	define TRACE_ZONE_DETAIL(name, detail) TraceZone TRACE_CONCAT(trace_zone_, __LINE__)(name, detail)
+#else
+#	define TRACE_ZONE(name)
+#	define TRACE_ZONE_DETAIL(name, detail)
+#endif